@@ -19,7 +19,8 @@ fi
 cd "$WORK_DIR" || exit
 
 CONFIG_BLOCK_SZ=512
-BLOCK_COUNT=8192
+DISK_SZ=$(numfmt --from=iec "${DDRIVER_DISK_SZ:-4M}")       # 与用户态驱动的 DDRIVER_DISK_SZ 保持一致
+BLOCK_COUNT=$((DISK_SZ / CONFIG_BLOCK_SZ))
 
 
 function usage(){
@@ -80,7 +81,8 @@ function install() {
         sudo rm $KERNEL_DEV_PATH>/dev/null 2>&1 
         sudo rmmod ddriver>/dev/null 2>&1 
         sudo dmesg -C
-        sudo insmod ./ddriver.ko
+        sudo insmod ./ddriver.ko disk_size="$DISK_SZ" \
+            shared_head="${DDRIVER_SHARED_HEAD:-0}"             # 内核态磁盘同样按 DDRIVER_DISK_SZ 分配; 1: 所有打开共用一个磁头
         in=$(dmesg | tail -n 1)
         tokens=("$in")
         major_number=${tokens[${#tokens[*]}-1]}
@@ -4,6 +4,14 @@
 #include <linux/fs.h>
 #include <asm/uaccess.h>
 #include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/uio.h>
+#include <linux/rwsem.h>
+#include <linux/spinlock.h>
 #include "ddriver_ctl.h"
 /******************************************************************************
 * SECTION: Macro definitions
@@ -27,14 +35,14 @@
                         "filp_open/cpp-filp_open-function-examples.html>"
 #define DRIVER_VERSION  "0.1.0"
 
-#define CONFIG_DISK_SZ  (4 * 1024 * 1024)
-#define CONFIG_BLOCK_SZ (512)
+#define CONFIG_DISK_SZ  "4M"                            /* Default, see disk_size param */
+#define CONFIG_BLOCK_SZ (512)                           /* Default, see iounit_size param */
 /******************************************************************************
 * SECTION: Macro Functions 
 *******************************************************************************/
 #define IGNORE_ARG(arg)         ((void)arg)
-#define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
-#define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
+#define IS_ADDR_ALIGN(addr)     (addr % disk.iounit_size == 0)
+#define ADDR_ROUND_UP(addr)     ((addr / disk.iounit_size) * disk.iounit_size)
 
 #define GET_HEAD_POS(disk)      (disk.head - disk.layout)
 #define FORWARD_HEAD(disk, dis) (disk.head += dis)
@@ -51,19 +59,37 @@ MODULE_LICENSE("GPL");
 MODULE_AUTHOR(DRIVER_AUTHOR);	    
 MODULE_DESCRIPTION(DRIVER_DESC);	
 MODULE_VERSION(DRIVER_VERSION);	
+
+static int iounit_size = CONFIG_BLOCK_SZ;
+module_param(iounit_size, int, 0444);
+MODULE_PARM_DESC(iounit_size, "IO unit in bytes, a power of 2 dividing the disk size");
+
+static char *disk_size = CONFIG_DISK_SZ;
+module_param(disk_size, charp, 0444);
+MODULE_PARM_DESC(disk_size, "Disk size with K/M/G suffix, a multiple of the page size");
+
+static bool shared_head = false;
+module_param(shared_head, bool, 0444);
+MODULE_PARM_DESC(shared_head, "Compatibility: one disk head moved by every seek, read and write, one opener");
 /******************************************************************************
 * SECTION: Type definitions
 *******************************************************************************/
 struct ddriver
 {
-    char layout[CONFIG_DISK_SZ];                      /* Disk Layout */
-    char *head;                                       /* Disk Head */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
+    char *layout;                                     /* Disk Layout, vmalloc_user, mmap-able */
+    char *head;                                       /* Disk Head, or where the last IO ended */
+    struct rw_semaphore lock;                         /* Layout, head, open_count. Shared by reads */
+    spinlock_t stat_lock;                             /* Counters below, bumped by parallel reads */
+    u64  read_cnt;                                    /* In IO units */
+    u64  write_cnt;
+    u64  seek_cnt;
+    u64  read_bytes;
+    u64  write_bytes;
+    u64  lat_hist[DDRIVER_LAT_OPS][DDRIVER_HIST_BUCKETS];
+    u64  seek_hist[DDRIVER_HIST_BUCKETS];
     int  major_num;
     int  open_count;
-    int  layout_size;
+    long long layout_size;
     int  iounit_size;
 };
 
@@ -74,107 +100,178 @@ static struct ddriver disk = {
     .seek_cnt    = 0,
     .major_num   = 0,
     .open_count  = 0,
-    .layout_size = CONFIG_DISK_SZ,
+    .layout_size = 0,
     .iounit_size = CONFIG_BLOCK_SZ
 };
 /******************************************************************************
 * SECTION: Helper Functions
 *******************************************************************************/
-int check_valid(size_t size){
-    if (GET_HEAD_POS(disk) >=  CONFIG_DISK_SZ) {
+static int check_valid(loff_t pos, size_t size){
+    if (pos < 0 || pos + (long long)size > disk.layout_size) {
         kernel_alert("disk head reach the end");
         return -EINVAL;
     }
-    if (size != CONFIG_BLOCK_SZ){
-        kernel_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
+    if (size == 0 || !IS_ADDR_ALIGN(size) || !IS_ADDR_ALIGN(pos)){
+        kernel_alert("io size %zu at %lld should align to %d", size, pos, disk.iounit_size);
         return -EIO;
     }
     return 0;
 }
+
+static int hist_bucket(u64 val) {
+    int bucket;
+    if (val == 0)
+        return 0;
+    bucket = ilog2(val);
+    return bucket < DDRIVER_HIST_BUCKETS ? bucket : DDRIVER_HIST_BUCKETS - 1;
+}
+
+static void stat_latency(int lat_op, u64 start_ns) {
+    disk.lat_hist[lat_op][hist_bucket(ktime_get_ns() - start_ns)]++;
+}
+
+static void stat_distance(char *from, char *to) {
+    u64 dis = (to > from ? to - from : from - to) / disk.iounit_size;
+    int bucket = 0;                                   /* [0]: sequential, [i]: [2^(i-1), 2^i) */
+
+    if (dis != 0) {
+        bucket = hist_bucket(dis) + 1;
+        if (bucket >= DDRIVER_HIST_BUCKETS)
+            bucket = DDRIVER_HIST_BUCKETS - 1;
+    }
+    disk.seek_hist[bucket]++;
+}
+
+static void stat_reset(void) {
+    disk.read_cnt    = 0;
+    disk.write_cnt   = 0;
+    disk.seek_cnt    = 0;
+    disk.read_bytes  = 0;
+    disk.write_bytes = 0;
+    memset(disk.lat_hist, 0, sizeof(disk.lat_hist));
+    memset(disk.seek_hist, 0, sizeof(disk.seek_hist));
+}
 /******************************************************************************
 * SECTION: Function definitions
 *******************************************************************************/
 static int      device_open(struct inode *, struct file *);
 static int      device_release(struct inode *, struct file *);
-static ssize_t  device_read(struct file *, char *, size_t, loff_t *);
-static ssize_t  device_write(struct file *, const char *, size_t, loff_t *);
+static ssize_t  device_read_iter(struct kiocb *, struct iov_iter *);
+static ssize_t  device_write_iter(struct kiocb *, struct iov_iter *);
 static loff_t   device_seek(struct file *, loff_t, int);
 static long     device_ioctl(struct file *, unsigned int, unsigned long);
+static int      device_mmap(struct file *, struct vm_area_struct *);
 /******************************************************************************
 * SECTION: Global var or structure definitions
 *******************************************************************************/
 static struct file_operations file_ops = {
-    .read = device_read,
-    .write = device_write,
+    .read_iter = device_read_iter,
+    .write_iter = device_write_iter,
     .open = device_open,
     .llseek = device_seek,
     .unlocked_ioctl = device_ioctl,
+    .mmap = device_mmap,
     .release = device_release
 };
 /******************************************************************************
 * SECTION: Function Implementation
 *******************************************************************************/
 /**
- * @brief Disk Read
+ * @brief Disk Read and Write of any number of IO units. Reads share the layout 
+ *        lock and run in parallel, writes and the shared head hold it exclusively
  * 
- * @param file          Ignored
- * @param user_buffer   User space buffer
- * @param size          Must equal to Blocksize @CONFIG_BLOCK_SZ
- * @param offset        Ignored
- * @return ssize_t      Bytes have been read 
+ * @param iocb          ki_pos is the caller's position, ignored with @shared_head
+ * @param iter          User buffers, total size aligned to @iounit_size
+ * @param op            DDRIVER_LAT_READ, DDRIVER_LAT_WRITE
+ * @return ssize_t      Bytes have been read or written
  */
 static ssize_t 
-device_read(struct file *file, char *user_buffer, size_t size, loff_t *offset) {
-    IGNORE_ARG(offset);
-    IGNORE_ARG(file);
-    int res = check_valid(size);
-    if(res < 0)
-        return res;
-    if (copy_to_user(user_buffer, disk.head, CONFIG_BLOCK_SZ))
-        return -EFAULT;
-    FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
-    INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+device_rw(struct kiocb *iocb, struct iov_iter *iter, int op) {
+    u64 start = ktime_get_ns();
+    size_t size = iov_iter_count(iter);
+    size_t done;
+    loff_t pos;
+    int res;
+
+    if (shared_head || op == DDRIVER_LAT_WRITE)
+        down_write(&disk.lock);
+    else
+        down_read(&disk.lock);
+    pos = shared_head ? GET_HEAD_POS(disk) : iocb->ki_pos;
+    res = check_valid(pos, size);
+    if (res < 0)
+        goto out;
+    if (op == DDRIVER_LAT_READ)
+        done = copy_to_iter(disk.layout + pos, size, iter);
+    else
+        done = copy_from_iter(disk.layout + pos, size, iter);
+    if (done != size) {
+        res = -EFAULT;
+        goto out;
+    }
+
+    spin_lock(&disk.stat_lock);
+    if (shared_head) {
+        FORWARD_HEAD(disk, size);
+    }
+    else {                                            /* Positioned IO, count implied seeks */
+        if (disk.head != disk.layout + pos) {
+            INC_SEEKCNT(disk);
+            stat_distance(disk.head, disk.layout + pos);
+        }
+        SET_HEAD(disk, pos + size);
+        iocb->ki_pos = pos + size;
+    }
+    if (op == DDRIVER_LAT_READ) {
+        disk.read_cnt   += size / disk.iounit_size;
+        disk.read_bytes += size;
+    }
+    else {
+        disk.write_cnt   += size / disk.iounit_size;
+        disk.write_bytes += size;
+    }
+    stat_latency(op, start);
+    spin_unlock(&disk.stat_lock);
+out:
+    if (shared_head || op == DDRIVER_LAT_WRITE)
+        up_write(&disk.lock);
+    else
+        up_read(&disk.lock);
+    return res < 0 ? (ssize_t)res : (ssize_t)size;
 }
-/**
- * @brief Disk Write
- * 
- * @param file          Ignored
- * @param user_buffer   User space buffer, copy content from
- * @param size          Must equal to Blocksize @CONFIG_BLOCK_SZ
- * @param offset        Ignored
- * @return ssize_t      Bytes have been written
- */
+
 static ssize_t 
-device_write(struct file *file, const char *user_buffer, size_t size, loff_t *offset) {
-    IGNORE_ARG(offset);
-    IGNORE_ARG(file);
-    int res = check_valid(size);
-    if(res < 0)
-        return res;
+device_read_iter(struct kiocb *iocb, struct iov_iter *iter) {
+    return device_rw(iocb, iter, DDRIVER_LAT_READ);
+}
 
-    if (copy_from_user(disk.head, user_buffer, CONFIG_BLOCK_SZ))
-        return -EFAULT;
-    FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
-    INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+static ssize_t 
+device_write_iter(struct kiocb *iocb, struct iov_iter *iter) {
+    return device_rw(iocb, iter, DDRIVER_LAT_WRITE);
 }
 /**
- * @brief Disk Seek
+ * @brief Disk Seek. Moves the file's own position, or the disk head with 
+ *        @shared_head, where it is also counted as a seek
  * 
- * @param file          Ignored
- * @param offset        Aligned to @CONFIG_BLOCK_SZ
- * @param whence        SEEK_CUR, SEEK_SET
+ * @param file          Position owner
+ * @param offset        Aligned to @iounit_size
+ * @param whence        SEEK_CUR, SEEK_SET, SEEK_END (not with @shared_head)
  * @return loff_t       cur pos
  */
 static loff_t 
 device_seek(struct file *file, loff_t offset, int whence) {
-    IGNORE_ARG(file);
+    u64 start = ktime_get_ns();
+    char *from;
     if (!IS_ADDR_ALIGN(offset)) {
         kernel_alert("offset %lld must be aligned to block size %d", 
-                      offset, CONFIG_BLOCK_SZ);
+                      offset, disk.iounit_size);
         return -EINVAL;
     }
+    if (!shared_head)
+        return fixed_size_llseek(file, offset, whence, disk.layout_size);
+
+    down_write(&disk.lock);
+    from = disk.head;
     switch (whence)
     {
     case SEEK_SET:
@@ -186,53 +283,141 @@ device_seek(struct file *file, loff_t offset, int whence) {
     default:
         break;
     }
+    spin_lock(&disk.stat_lock);
     INC_SEEKCNT(disk);
-    return GET_HEAD_POS(disk);
+    stat_distance(from, disk.head);
+    stat_latency(DDRIVER_LAT_SEEK, start);
+    spin_unlock(&disk.stat_lock);
+    offset = GET_HEAD_POS(disk);
+    up_write(&disk.lock);
+    return offset;
 }
 /**
  * @brief Disk ioctl
  * 
- * @param file          Ignored
+ * @param file          Its position is reset by IOC_REQ_DEVICE_RESET
  * @param cmd           Command
  * @param arg           Args
  * @return long         State
  */
 static long 
 device_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
-    IGNORE_ARG(file);
     int ret;
+    int size;
     struct ddriver_state state;
+    struct ddriver_discard discard;
+    struct ddriver_state_ext *ext;
+    if (_IOC_TYPE(cmd) == IOC_MAGIC && _IOC_NR(cmd) == _IOC_NR(IOC_REQ_DEVICE_STATE_EXT))
+        cmd = IOC_REQ_DEVICE_STATE_EXT;               /* Encoded size follows the caller's version */
     switch (cmd)
     {
     case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
-        ret = copy_to_user((int __user *)arg, &disk.layout_size, sizeof(int));
+        size = disk.layout_size > INT_MAX ? INT_MAX : (int)disk.layout_size;
+        ret = copy_to_user((int __user *)arg, &size, sizeof(int));
+        if (ret) 
+            return -EFAULT;
+        break;
+    case IOC_REQ_DEVICE_SIZE64:                       /* Device Size, 64 bit */
+        ret = copy_to_user((long long __user *)arg, &disk.layout_size, sizeof(long long));
         if (ret) 
             return -EFAULT;
         break;
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
+        memset(&state, 0, sizeof(struct ddriver_state));
+        spin_lock(&disk.stat_lock);
+        state.read_cnt = (int)disk.read_cnt;
+        state.write_cnt = (int)disk.write_cnt;
+        state.seek_cnt = (int)disk.seek_cnt;
+        spin_unlock(&disk.stat_lock);
         ret = copy_to_user((int __user *)arg, &state, sizeof(struct ddriver_state));
         if (ret) 
             return -EFAULT;
         break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
-        disk.head = disk.layout;
-        disk.read_cnt = 0;
-        disk.write_cnt = 0;
-        disk.seek_cnt = 0;
+        down_write(&disk.lock);
+        RESET_HEAD(disk);
+        if (!shared_head)
+            file->f_pos = 0;
+        spin_lock(&disk.stat_lock);
+        stat_reset();
+        spin_unlock(&disk.stat_lock);
+        up_write(&disk.lock);
+        break;
+    case IOC_REQ_DEVICE_STATE_EXT:                    /* Versioned State, truncated to caller's size */
+        ext = kzalloc(sizeof(struct ddriver_state_ext), GFP_KERNEL);
+        if (!ext)
+            return -ENOMEM;
+        if (copy_from_user(ext, (void __user *)arg, 2 * sizeof(int))) {
+            kfree(ext);
+            return -EFAULT;
+        }
+        if (ext->version < 1 || ext->size < 2 * (int)sizeof(int)) {
+            kfree(ext);
+            return -EINVAL;
+        }
+        size = min_t(int, ext->size, sizeof(struct ddriver_state_ext));
+        ext->version     = DDRIVER_STATE_VERSION;
+        ext->size        = size;
+        spin_lock(&disk.stat_lock);
+        ext->read_cnt    = disk.read_cnt;
+        ext->write_cnt   = disk.write_cnt;
+        ext->seek_cnt    = disk.seek_cnt;
+        ext->read_bytes  = disk.read_bytes;
+        ext->write_bytes = disk.write_bytes;
+        memcpy(ext->lat_hist, disk.lat_hist, sizeof(ext->lat_hist));
+        memcpy(ext->seek_hist, disk.seek_hist, sizeof(ext->seek_hist));
+        spin_unlock(&disk.stat_lock);
+        ret = copy_to_user((void __user *)arg, ext, size);
+        kfree(ext);
+        if (ret)
+            return -EFAULT;
         break;
     case IOC_REQ_DEVICE_IO_SZ:
         ret = copy_to_user((int __user *)arg, &disk.iounit_size, sizeof(int));
         if (ret) 
             return -EFAULT;
         break;
+    case IOC_REQ_DEVICE_FLUSH:                        /* No write-back cache, layout is memory */
+        break;
+    case IOC_REQ_DEVICE_SNAPSHOT:                     /* Image snapshots are user ddriver only */
+    case IOC_REQ_DEVICE_ROLLBACK:
+    case IOC_REQ_DEVICE_TAG:                          /* So are request tags */
+    case IOC_REQ_DEVICE_HEATMAP:                      /* and heatmaps */
+    case IOC_REQ_DEVICE_ATOMIC_WRITE:                 /* and atomic writes */
+        return -EOPNOTSUPP;
+    case IOC_REQ_DEVICE_DISCARD:                      /* TRIM a range */
+        ret = copy_from_user(&discard, (struct ddriver_discard __user *)arg, 
+                             sizeof(struct ddriver_discard));
+        if (ret) 
+            return -EFAULT;
+        if (!IS_ADDR_ALIGN(discard.offset) || !IS_ADDR_ALIGN(discard.len) ||
+            discard.offset < 0 || discard.len < 0 ||
+            discard.offset + discard.len > disk.layout_size)
+            return -EINVAL;
+        down_write(&disk.lock);
+        memset(disk.layout + discard.offset, 0, discard.len);
+        up_write(&disk.lock);
+        break;
     default:
         break;
     }
     return 0;
 }
+/**
+ * @brief Disk Mmap, map the layout into user space. Loads and stores through
+ *        the mapping skip the syscall and copy, and are not counted in the state
+ * 
+ * @param file          Ignored
+ * @param vma           MAP_SHARED, vm_pgoff is the page offset in the layout
+ * @return int          state
+ */
+static int 
+device_mmap(struct file *file, struct vm_area_struct *vma) {
+    IGNORE_ARG(file);
+    if (!(vma->vm_flags & VM_SHARED))
+        return -EINVAL;
+    return remap_vmalloc_range(vma, disk.layout, vma->vm_pgoff);
+}
 /**
  * @brief Disk Open
  * 
@@ -245,11 +430,15 @@ device_open(struct inode *inode, struct file *file) {
     IGNORE_ARG(inode);
     IGNORE_ARG(file);
     
-    if (disk.open_count) {                            /* If device is open, return busy */
+    down_write(&disk.lock);
+    if (disk.open_count && shared_head) {             /* One head, one user: return busy */
+        up_write(&disk.lock);
         return -EBUSY;
     }
-    RESET_HEAD(disk);                                 /* Everytime close device, reset head */
+    if (!disk.open_count)
+        RESET_HEAD(disk);                             /* Everytime close device, reset head */
     disk.open_count++;
+    up_write(&disk.lock);
     try_module_get(THIS_MODULE);
     return 0;
 }
@@ -266,7 +455,9 @@ device_release(struct inode *inode, struct file *file) {
                                                          Without this, the module would not unload. */
     IGNORE_ARG(inode);
     IGNORE_ARG(file);
+    down_write(&disk.lock);
     disk.open_count--;
+    up_write(&disk.lock);
     module_put(THIS_MODULE);
     return 0;
 }
@@ -276,16 +467,40 @@ device_release(struct inode *inode, struct file *file) {
 static int __init 
 ddriver_init(void)
 {
-    int major_num = register_chrdev(0, DEVICE_NAME, &file_ops);   
+    int major_num;
+    char *end;
+
+    disk.layout_size = memparse(disk_size, &end);
+    if (*end != '\0' || disk.layout_size <= 0 || !PAGE_ALIGNED(disk.layout_size)) {
+        kernel_alert("invalid disk_size %s", disk_size);
+        return -EINVAL;
+    }
+    if (iounit_size < CONFIG_BLOCK_SZ || (iounit_size & (iounit_size - 1)) ||
+        disk.layout_size % iounit_size) {
+        kernel_alert("invalid iounit_size %d", iounit_size);
+        return -EINVAL;
+    }
+    disk.iounit_size = iounit_size;
+    disk.layout = vmalloc_user(disk.layout_size);     /* Zeroed */
+    if (!disk.layout) {
+        kernel_alert("can't alloc %lld bytes disk", disk.layout_size);
+        return -ENOMEM;
+    }
+    init_rwsem(&disk.lock);
+    spin_lock_init(&disk.stat_lock);
+    kernel_info("disk %lld bytes, io unit %d%s", disk.layout_size, disk.iounit_size,
+                shared_head ? ", shared head" : "");
+
+    major_num = register_chrdev(0, DEVICE_NAME, &file_ops);   
                                                       /* Register an device */
     if (major_num < 0) {                              /* Register fail */
         kernel_alert("Can't register device, ret %d", major_num);
+        vfree(disk.layout);
         return major_num;
     } 
     else {                                            /* Register success */                                                  
         kernel_info("module loaded with device major number %d", major_num);
         disk.major_num = major_num;
-        memset(disk.layout, 0, CONFIG_DISK_SZ);
         return 0;
     }
     return 0;
@@ -299,6 +514,7 @@ ddriver_exit(void)
     if(major_num != 0){
         unregister_chrdev(major_num, DEVICE_NAME);
     }
+    vfree(disk.layout);
 }
 
 module_init(ddriver_init);
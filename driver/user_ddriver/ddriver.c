@@ -1,152 +1,482 @@
+#define _GNU_SOURCE                                     /* fallocate */
 #include "stdio.h"
 #include "stdlib.h"
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
 #include "string.h"
 #include <linux/fs.h>
-#include "ddriver_ctl.h"
+#include "ddriver_internal.h"
 #include "stdio.h"
 #include "asm-generic/errno-base.h"
 #include <pwd.h>
+#include <sys/mman.h>
+#include <limits.h>
 
-#define USER_INFO     "INFO: "
-#define USER_ALERT    "WARNING: "
-
-#define USER_PANIC    "PANIC: "
-/******************************************************************************
-* SECTION: Macro definitions
-*******************************************************************************/   
-#define DEVICE_NAME   "ddriver"
-#define DEVICE_LOG    "ddriver_log"
-
-#define user_info(fmt, ...)\
-	do {\
-		printf(USER_INFO DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);\
-        fprintf(debugf, USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
-	} while(0)\
-
-#define user_alert(fmt, ...)\
-	do {\
-		printf(USER_ALERT DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);\
-        fprintf(debugf, USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
-	} while(0)\
-
-#define user_panic(fmt, ...)\
-    do {\
-        printf(USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
-    } while (0)\
-
-#define DRIVER_AUTHOR   "Deadpool <deadpoolmine@qq.com>"
-#define DRIVER_DESC     "A Fake disk driver in user space"
-#define DRIVER_VERSION  "0.1.0"
-
-#define CONFIG_DISK_SZ  (4 * 1024 * 1024)
-#define CONFIG_BLOCK_SZ (512)
-/******************************************************************************
-* SECTION: Macro Functions 
-*******************************************************************************/
-#define IGNORE_ARG(arg)         ((void)arg)
-#define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
-#define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
-
-#define INC_READCNT(disk)       (disk.read_cnt++)
-#define INC_WRITECNT(disk)      (disk.write_cnt++)
-#define INC_SEEKCNT(disk)       (disk.seek_cnt++)
-/******************************************************************************
-* SECTION: Type definitions
-*******************************************************************************/
-struct ddriver
-{
-    int  ddriver_fd;                                 /* Disk ddriver_fd */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
-    int  major_num;
-    int  open_count;
-    int  layout_size;
-    int  iounit_size;
-};
 /******************************************************************************
 * SECTION: Global Variable
 *******************************************************************************/
-struct ddriver disk = {
-    .read_cnt    = 0,
-    .write_cnt   = 0,
-    .seek_cnt    = 0,
-    .major_num   = 0,
-    .open_count  = 0,
-    .layout_size = CONFIG_DISK_SZ,
-    .iounit_size = CONFIG_BLOCK_SZ
-};
-
-FILE *debugf = NULL;
+static struct ddriver *devices[CONFIG_MAX_FDS];     /* Indexed by handle (image fd) */
+static pthread_mutex_t devices_lock = PTHREAD_MUTEX_INITIALIZER;
 /******************************************************************************
 * SECTION: Helper Functions
 *******************************************************************************/
-int check_valid(size_t size){
-    if (size != CONFIG_BLOCK_SZ){
-        user_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
+/**
+ * @brief 由句柄找到设备，句柄即镜像文件的fd
+ * 
+ * @param fd 
+ * @return struct ddriver* 未打开返回NULL
+ */
+struct ddriver *dev_get(int fd){
+    if (fd < 0 || fd >= CONFIG_MAX_FDS)
+        return NULL;
+    return __atomic_load_n(&devices[fd], __ATOMIC_ACQUIRE);
+}
+
+static void dev_free(struct ddriver *disk){
+    aio_teardown(disk);
+    cache_teardown(disk);
+    model_teardown(disk);
+    trace_teardown(disk);
+    snap_teardown(disk);
+    heat_teardown(disk);
+    elide_teardown(disk);
+    image_teardown(disk);
+    log_teardown(disk);                               /* Last, the others may still log */
+    if (IS_MAPPED(disk))
+        munmap(disk->map, disk->layout_size);
+    pthread_rwlock_destroy(&disk->io_lock);
+    free(disk->path);
+    free(disk);
+}
+
+static int check_valid(struct ddriver *disk, size_t size){
+    if (size != disk->iounit_size){
+        user_alert("io size %ld should align to %d", size, disk->iounit_size);
         return -EIO;
     }
     return 0;
 }
+
+int check_range(struct ddriver *disk, off_t lba, int blks){
+    if (blks <= 0) {
+        user_alert("block count %d should be positive", blks);
+        return -EINVAL;
+    }
+    if (lba < 0 || (lba + blks) * disk->iounit_size > disk->layout_size) {
+        user_alert("blocks [%ld, %ld) out of device range", lba, lba + blks);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int check_pio(struct ddriver *disk, off_t offset, size_t size){
+    if (!IS_ADDR_ALIGN(offset) || size % disk->iounit_size != 0) {
+        user_alert("offset %ld and size %ld must be aligned to block size %d", 
+                      offset, size, disk->iounit_size);
+        return -EINVAL;
+    }
+    return check_range(disk, offset / disk->iounit_size, size / disk->iounit_size);
+}
+
+/**
+ * @brief 取得游标处的size字节并把游标后移。越界时游标不动，返回-EINVAL
+ *
+ * @param offset 出: 本次IO的设备偏移
+ * @return int
+ */
+static int cursor_take(struct ddriver *disk, size_t size, off_t *offset){
+    off_t cur = ATOMIC_LOAD(disk->cursor);
+    int res;
+
+    do {
+        if ((res = check_pio(disk, cur, size)) < 0)
+            return res;
+    } while (!ATOMIC_CAS(disk->cursor, cur, cur + (off_t)size));  /* cur reloaded on failure */
+    *offset = cur;
+    return 0;
+}
+
+static int check_geometry(off_t layout_size, int iounit_size){
+    if (iounit_size < CONFIG_BLOCK_SZ || iounit_size > CONFIG_MAX_BLOCK_SZ ||
+        (iounit_size & (iounit_size - 1)) != 0) {
+        user_panic("io unit %d should be a power of 2 in [%d, %d]", 
+                   iounit_size, CONFIG_BLOCK_SZ, CONFIG_MAX_BLOCK_SZ);
+        return -EINVAL;
+    }
+    if (layout_size <= 0 || layout_size % iounit_size != 0) {
+        user_panic("disk size %ld should be a positive multiple of io unit %d", 
+                   layout_size, iounit_size);
+        return -EINVAL;
+    }
+    return 0;
+}
+/**
+ * @brief 丢弃[offset, offset + len)的数据，之后读出全0。优先在镜像上打洞，
+ * 宿主文件系统不支持时，整盘退化为截断再扩展，部分区间退化为写0。
+ * 稀疏镜像交给ddriver_image.c按簇打洞
+ * undo log快照下先保存被丢弃的内容
+ * 
+ * @param offset 
+ * @param len 
+ * @return int 
+ */
+static int discard_range(struct ddriver *disk, off_t offset, off_t len){
+    int fd = disk->ddriver_fd;
+    static char zero[CONFIG_MAX_BLOCK_SZ];
+    off_t done;
+    size_t chunk;
+    int ret;
+
+    if ((ret = snap_preserve(disk, offset, len)) < 0)
+        return ret;
+    if (disk->image != NULL)
+        return image_discard(disk, offset, len);
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) == 0)
+        return 0;
+    if (errno != EOPNOTSUPP && errno != ENOSYS) {
+        user_alert("discard [%ld, %ld) failed: %d", offset, offset + len, errno);
+        return -errno;
+    }
+
+    if (offset == 0 && len == disk->layout_size &&
+        ftruncate(fd, 0) == 0 && ftruncate(fd, len) == 0)
+        return 0;
+    if (IS_MAPPED(disk)) {
+        memset(disk->map + offset, 0, len);
+        return 0;
+    }
+    for (done = 0; done < len; done += chunk) {
+        chunk = len - done > sizeof(zero) ? sizeof(zero) : len - done;
+        errno = 0;
+        if (pwrite(fd, zero, chunk, offset + done) != (ssize_t)chunk) {
+            ret = errno != 0 ? -errno : -EIO;             /* Short write: caller must not assume zeros */
+            user_alert("zero fill [%ld, %ld) failed: %d", offset, offset + len, ret);
+            return ret;
+        }
+    }
+    return 0;
+}
+/**
+ * @brief 把一段连续的读写交给缓存、映射或镜像，并计入统计
+ *
+ * @return ssize_t 字节数，负数为-errno
+ */
+static ssize_t dev_io(struct ddriver *disk, int op, char *buf, size_t len, off_t at){
+    ssize_t ret = len;
+    int res;
+
+    if (disk->cache != NULL)                          /* Device IO is accounted by the cache */
+        return op == DDRIVER_OP_READ ? cache_read(disk, buf, len, at)
+                                     : cache_write(disk, buf, len, at);
+    if (op == DDRIVER_OP_WRITE && (res = snap_preserve(disk, at, len)) < 0)
+        return res;
+    if (IS_MAPPED(disk)) {
+        if (op == DDRIVER_OP_READ)
+            memcpy(buf, disk->map + at, len);
+        else
+            memcpy(disk->map + at, buf, len);
+    }
+    else if (op == DDRIVER_OP_READ) {
+        ret = image_read(disk, buf, len, at);
+    }
+    else {
+        ret = image_write(disk, buf, len, at);
+    }
+    if (ret >= 0)
+        stat_io(disk, op, at, len);
+    return ret;
+}
+/**
+ * @brief 所有读写最终都走这里：只用定位IO，持io_lock读锁，与重置互斥。
+ * 开启写消除时，写被拆成内容变化的几段分别下发
+ * 
+ * @param op DDRIVER_OP_READ / DDRIVER_OP_WRITE
+ * @param buf 
+ * @param size 
+ * @param offset 已校验过的设备偏移
+ * @return int 字节数，负数为-errno
+ */
+int do_io(struct ddriver *disk, int op, char *buf, size_t size, off_t offset){
+    unsigned long long start = stat_now();
+    unsigned long long gen;
+    size_t done, run;
+    ssize_t ret = size;
+
+    trace_record(disk, op == DDRIVER_OP_READ ? TRACE_OP_READ : TRACE_OP_WRITE, offset, size);
+    IO_BEGIN(disk);
+    gen = elide_begin(disk, op);
+    if (op == DDRIVER_OP_READ) {
+        ret = dev_io(disk, op, buf, size, offset);
+    }
+    else {
+        for (done = 0; done < size && ret >= 0; done += run) {
+            done += elide_next(disk, buf + done, size - done, offset + done, &run);
+            if (run > 0)                              /* Unchanged IO units are not written */
+                ret = dev_io(disk, op, buf + done, run, offset + done);
+        }
+    }
+    if (ret >= 0) {
+        elide_record(disk, gen, op, buf, size, offset);
+        stat_latency(disk, op == DDRIVER_OP_READ ? DDRIVER_LAT_READ : DDRIVER_LAT_WRITE, start);
+        stat_tag(disk, stat_get_tag(), op, size, start);
+        if (op == DDRIVER_OP_WRITE)                   /* Elided units count as written */
+            ret = size;
+    }
+    else if (op == DDRIVER_OP_WRITE) {
+        elide_invalidate(disk, offset, size);         /* Earlier runs may have landed */
+    }
+    IO_END(disk);
+    return (int)ret;
+}
+/**
+ * @brief 解析容量字符串，支持K/M/G后缀，如 "512", "4K", "2G"
+ * 
+ * @param str 
+ * @return long long 解析失败返回0
+ */
+long long parse_size(const char *str){
+    char *end;
+    long long val = strtoll(str, &end, 0);
+
+    switch (*end)
+    {
+    case 'G': case 'g':
+        val <<= 10;
+        /* fall through */
+    case 'M': case 'm':
+        val <<= 10;
+        /* fall through */
+    case 'K': case 'k':
+        val <<= 10;
+        end++;
+        break;
+    default:
+        break;
+    }
+    if (*end != '\0' || val < 0)
+        return 0;
+    return val;
+}
 /******************************************************************************
 * SECTION: Global Function Implementation
 *******************************************************************************/
 /**
- * @brief 打开驱动
+ * @brief 打开驱动，选项从环境变量读取:
+ * DDRIVER_MMAP=1 开启mmap模式，DDRIVER_DISK_SZ=2G 指定磁盘大小，
+ * DDRIVER_IO_SZ=4K 指定IO单位，DDRIVER_QD=128 指定异步队列深度，
+ * DDRIVER_CACHE=1M 开启写回缓存，DDRIVER_MODEL=hdd|ssd|nvme 选择设备模型，
+ * DDRIVER_MODEL_SLEEP=1 按模型时间真实睡眠，DDRIVER_BW=50M 限制带宽(字节/秒)，
+ * DDRIVER_TRACE=路径 记录块IO trace，DDRIVER_TRACE_SZ=64M 指定trace文件大小，
+ * DDRIVER_LOG=none|alert|info 指定日志级别，DDRIVER_HEATMAP=1 统计每个IO单位的访问热度，
+ * DDRIVER_SPARSE=1 新建的镜像使用稀疏格式，DDRIVER_ELIDE=1 跳过内容未变的写
  * 
- * @return int 文件描述符
+ * @param path 镜像文件路径，不存在则创建
+ * @return int 设备句柄
  */
 int ddriver_open(char *path) {
-    int fd, ret = 0;
-    char device_path[128] = {0};
-    char log_path[128] = {0};
-    
-    sprintf(device_path, "%s/" DEVICE_NAME, getpwuid(getuid())->pw_dir);
-    sprintf(log_path, "%s/" DEVICE_LOG, getpwuid(getuid())->pw_dir);
-    
-    if (strcmp(device_path, path) != 0) {
-        user_panic("wrong path [%s], should be [%s]", path, device_path);
-        return -1;
+    struct ddriver_options opts = {
+        .flags       = 0,
+        .disk_size   = 0,
+        .iounit_size = 0,
+        .queue_depth = 0,
+        .cache_size  = 0,
+        .model       = DDRIVER_MODEL_NONE,
+        .bw_limit    = 0,
+        .trace_path  = NULL,
+        .trace_size  = 0,
+        .log_level   = DDRIVER_LOG_DEFAULT
+    };
+    char *env = getenv(ENV_MMAP);
+
+    if (env != NULL && atoi(env) != 0) {
+        opts.flags |= DDRIVER_OPT_MMAP;
+    }
+    if ((env = getenv(ENV_DISK_SZ)) != NULL) {
+        opts.disk_size = parse_size(env);
+    }
+    if ((env = getenv(ENV_IO_SZ)) != NULL) {
+        opts.iounit_size = (int)parse_size(env);
+    }
+    if ((env = getenv(ENV_QD)) != NULL) {
+        opts.queue_depth = atoi(env);
+    }
+    if ((env = getenv(ENV_CACHE)) != NULL) {
+        opts.cache_size = parse_size(env);
+    }
+    if ((env = getenv(ENV_MODEL)) != NULL) {
+        opts.model = model_lookup(env);
+    }
+    if ((env = getenv(ENV_SLEEP)) != NULL && atoi(env) != 0) {
+        opts.flags |= DDRIVER_OPT_SLEEP;
+    }
+    if ((env = getenv(ENV_BW)) != NULL) {
+        opts.bw_limit = parse_size(env);
+    }
+    opts.trace_path = getenv(ENV_TRACE);
+    if ((env = getenv(ENV_TRACE_SZ)) != NULL) {
+        opts.trace_size = parse_size(env);
     }
+    if ((env = getenv(ENV_LOG)) != NULL) {
+        opts.log_level = log_lookup(env);
+    }
+    if ((env = getenv(ENV_HEATMAP)) != NULL && atoi(env) != 0) {
+        opts.flags |= DDRIVER_OPT_HEATMAP;
+    }
+    if ((env = getenv(ENV_SPARSE)) != NULL && atoi(env) != 0) {
+        opts.flags |= DDRIVER_OPT_SPARSE;
+    }
+    if ((env = getenv(ENV_ELIDE)) != NULL && atoi(env) != 0) {
+        opts.flags |= DDRIVER_OPT_ELIDE;
+    }
+    return ddriver_open_opts(path, &opts);
+}
+/**
+ * @brief 按选项打开驱动。每次打开都是独立的设备实例，拥有自己的几何参数、
+ * 统计、日志(镜像路径加_log后缀)与缓存，同一进程内可同时打开多个镜像
+ * 
+ * @param path 镜像文件路径，不存在则创建
+ * @param opts 为NULL时使用默认选项
+ * @return int 设备句柄，即镜像文件的fd，失败返回负数
+ */
+int ddriver_open_opts(char *path, struct ddriver_options *opts) {
+    struct ddriver *disk;
+    int fd, ret = 0;
+    char log_path[PATH_MAX] = {0};
+    char heat_path[PATH_MAX];
+    off_t layout_size = CONFIG_DISK_SZ;
+    int   iounit_size = CONFIG_BLOCK_SZ;
 
-    if (access(device_path, F_OK) == 0) {
-        fd = open(device_path, O_RDWR);
+    if (opts != NULL && opts->disk_size != 0) {
+        layout_size = opts->disk_size;
     }
-    else {
-        fd = open(device_path, O_CREAT | O_TRUNC | O_RDWR);
+    if (opts != NULL && opts->iounit_size != 0) {
+        iounit_size = opts->iounit_size;
+    }
+    if (check_geometry(layout_size, iounit_size) < 0) {
+        return -EINVAL;
     }
+    if (opts != NULL && (opts->model < DDRIVER_MODEL_NONE || opts->model > DDRIVER_MODEL_NVME)) {
+        user_panic("unknown device model %d", opts->model);
+        return -EINVAL;
+    }
+    if (opts != NULL && opts->bw_limit < 0) {
+        user_panic("negative bandwidth limit %lld", opts->bw_limit);
+        return -EINVAL;
+    }
+    if (path == NULL || snprintf(log_path, sizeof(log_path), "%s" DEVICE_LOG, path) >= 
+                        (int)sizeof(log_path)) {
+        user_panic("bad device path");
+        return -EINVAL;
+    }
+
+    fd = open(path, O_CREAT | O_RDWR, 0644);
     if (fd < 0) {
-        user_panic("can't open device: %d", fd);
-        return fd;
+        user_panic("can't open device %s: %d", path, errno);
+        return -errno;
     }
-    ret = posix_fallocate(fd, 0, CONFIG_DISK_SZ);
-    if (ret < 0) {
-        user_panic("low space");
-        return ret;
+    if (fd >= CONFIG_MAX_FDS) {
+        user_panic("too many open devices");
+        close(fd);
+        return -EMFILE;
+    }
+    disk = (struct ddriver *)calloc(1, sizeof(struct ddriver));
+    if (disk == NULL) {
+        close(fd);
+        return -ENOMEM;
+    }
+    pthread_rwlock_init(&disk->io_lock, NULL);
+    disk->ddriver_fd  = fd;
+    disk->path        = strdup(path);
+    disk->layout_size = layout_size;
+    disk->iounit_size = iounit_size;
+    disk->queue_depth = CONFIG_QUEUE_DEPTH;
+    if (opts != NULL && opts->queue_depth > 0) {
+        disk->queue_depth = opts->queue_depth;
+    }
+
+    disk->log_level = DDRIVER_LOG_INFO;
+    if (opts != NULL && opts->log_level != DDRIVER_LOG_DEFAULT) {
+        disk->log_level = opts->log_level;
     }
 
-    debugf = fopen(log_path, "w+");
-    if (debugf == NULL) {
+    if (log_setup(disk, log_path) < 0) {
         user_panic("can't init log: %s", log_path);
-        return -1;
+        dev_free(disk);
+        close(fd);
+        return -EIO;
+    }
+    if ((ret = image_setup(disk, opts != NULL && (opts->flags & DDRIVER_OPT_SPARSE))) < 0) {
+        user_panic("can't init image, low space? %d", ret);
+        dev_free(disk);
+        close(fd);
+        return ret;
+    }
+    if (aio_init(disk) < 0) {
+        dev_free(disk);
+        close(fd);
+        return -ENOMEM;
+    }
+    redo_recover(disk);                               /* Before the cache and the mapping */
+
+    if (opts != NULL && (opts->flags & DDRIVER_OPT_MMAP) && disk->image != NULL) {
+        user_alert("sparse image can't be mapped, fall back to syscall io");
+    }
+    else if (opts != NULL && (opts->flags & DDRIVER_OPT_MMAP)) {
+        disk->map = mmap(NULL, disk->layout_size, PROT_READ | PROT_WRITE, 
+                        MAP_SHARED, fd, 0);
+        if (disk->map == MAP_FAILED) {
+            disk->map = NULL;
+            user_alert("mmap failed, fall back to syscall io");
+        }
+    }
+    if (opts != NULL && opts->cache_size > 0 && !IS_MAPPED(disk) &&
+        cache_setup(disk, opts->cache_size) < 0) {
+        user_alert("can't alloc write-back cache, run without it");
+    }
+    if (opts != NULL)
+        model_setup(disk, opts->model, opts->flags & DDRIVER_OPT_SLEEP, opts->bw_limit);
+    if (opts != NULL && opts->trace_path != NULL &&
+        (ret = trace_setup(disk, opts->trace_path, opts->trace_size > 0 ? opts->trace_size
+                                                                         : CONFIG_TRACE_SZ)) < 0) {
+        user_alert("can't open trace %s: %d, run without it", opts->trace_path, ret);
+    }
+    if (opts != NULL && (opts->flags & DDRIVER_OPT_HEATMAP)) {
+        snprintf(heat_path, sizeof(heat_path), "%s" DEVICE_HEAT, path);
+        if ((ret = heat_setup(disk, heat_path)) < 0)
+            user_alert("can't open heatmap %s: %d, run without it", heat_path, ret);
+    }
+    if (opts != NULL && (opts->flags & DDRIVER_OPT_ELIDE) && (ret = elide_setup(disk)) < 0) {
+        user_alert("can't alloc write elision hashes: %d, run without it", ret);
     }
 
+    pthread_mutex_lock(&devices_lock);
+    __atomic_store_n(&devices[fd], disk, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&devices_lock);
     return fd;
 }
 /**
- * @brief 关闭驱动
+ * @brief 关闭驱动，等待在途异步请求、刷回缓存并释放设备
  * 
  * @param fd 
  * @return int 
  */
 int ddriver_close(int fd) {
-    return close(fd) && fclose(debugf);
+    struct ddriver *disk = dev_get(fd);
+
+    if (disk == NULL)
+        return -EBADF;
+    aio_teardown(disk);                               /* Reaps through the handle */
+    pthread_mutex_lock(&devices_lock);
+    __atomic_store_n(&devices[fd], NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&devices_lock);
+
+    dev_free(disk);
+    return close(fd);
 }
 /**
- * @brief 磁盘头SEEK
+ * @brief 磁盘头SEEK，只移动驱动自己维护的游标，不改动fd的文件偏移
  * 
  * @param fd 
  * @param offset 
@@ -154,16 +484,39 @@ int ddriver_close(int fd) {
  * @return int 
  */
 int ddriver_seek(int fd, off_t offset, int whence){
+    struct ddriver *disk = dev_get(fd);
+    unsigned long long start = stat_now();
+
+    if (disk == NULL)
+        return -EBADF;
     if (!IS_ADDR_ALIGN(offset)) {
         user_alert("offset %ld must be aligned to block size %d", 
-                      offset, CONFIG_BLOCK_SZ);
+                      offset, disk->iounit_size);
+        return -EINVAL;
+    }
+    switch (whence)
+    {
+    case SEEK_SET:
+        ATOMIC_STORE(disk->cursor, offset);
+        break;
+    case SEEK_CUR:
+        offset += ATOMIC_ADD(disk->cursor, offset);
+        break;
+    case SEEK_END:
+        offset += disk->layout_size;
+        ATOMIC_STORE(disk->cursor, offset);
+        break;
+    default:
         return -EINVAL;
     }
-    INC_SEEKCNT(disk);
-    return lseek(fd, offset, whence);
+    trace_record(disk, TRACE_OP_SEEK, offset, 0);
+    stat_seek(disk, offset);
+    stat_latency(disk, DDRIVER_LAT_SEEK, start);
+    return offset;
 }
 /**
- * @brief 磁盘写入，写入大小可通过IOCTL查询
+ * @brief 磁盘写入，写入大小可通过IOCTL查询。游标原子前移，
+ * 多线程同时调用时各自写入不同的IO单位
  * 
  * @param fd 
  * @param buf 
@@ -171,14 +524,19 @@ int ddriver_seek(int fd, off_t offset, int whence){
  * @return int 
  */
 int ddriver_write(int fd, char *buf, size_t size){
-    int res = check_valid(size);
-    if(res < 0)
-        return res;
+    struct ddriver *disk = dev_get(fd);
+    off_t offset;
+    int res;
 
-    write(fd, buf, size);
+    if (disk == NULL)
+        return -EBADF;
+    if ((res = check_valid(disk, size)) < 0)
+        return res;
 
-    INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+    if ((res = cursor_take(disk, size, &offset)) < 0)       /* Cursor past the device end */
+        return res;
+    res = do_io(disk, DDRIVER_OP_WRITE, buf, size, offset);
+    return res < 0 ? res : disk->iounit_size;
 }
 /**
  * @brief 
@@ -189,14 +547,19 @@ int ddriver_write(int fd, char *buf, size_t size){
  * @return int 
  */
 int ddriver_read(int fd, char *buf, size_t size){
-    int res = check_valid(size);
-    if(res < 0)
-        return res;
+    struct ddriver *disk = dev_get(fd);
+    off_t offset;
+    int res;
 
-    read(fd, buf, size);
+    if (disk == NULL)
+        return -EBADF;
+    if ((res = check_valid(disk, size)) < 0)
+        return res;
 
-    INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+    if ((res = cursor_take(disk, size, &offset)) < 0)       /* Cursor past the device end */
+        return res;
+    res = do_io(disk, DDRIVER_OP_READ, buf, size, offset);
+    return res < 0 ? res : disk->iounit_size;
 }
 /**
  * @brief 
@@ -207,35 +570,215 @@ int ddriver_read(int fd, char *buf, size_t size){
  * @return int 
  */
 int ddriver_ioctl(int fd, unsigned long cmd, void *arg){
+    struct ddriver *disk = dev_get(fd);
     struct ddriver_state state;
+    struct ddriver_discard *discard;
+    long long size64;
+    int size, flags;
+
+    if (disk == NULL)
+        return -EBADF;
+    if (cmd == IOC_REQ_DEVICE_DISCARD && arg == NULL)
+        return -EINVAL;
+    if (_IOC_TYPE(cmd) == IOC_MAGIC && _IOC_NR(cmd) == _IOC_NR(IOC_REQ_DEVICE_STATE_EXT))
+        cmd = IOC_REQ_DEVICE_STATE_EXT;               /* Encoded size follows the caller's version */
+
+    if (cmd == IOC_REQ_DEVICE_DISCARD)
+        trace_record(disk, TRACE_OP_DISCARD, ((struct ddriver_discard *)arg)->offset,
+                     ((struct ddriver_discard *)arg)->len / disk->iounit_size);
+    else if (cmd == IOC_REQ_DEVICE_FLUSH)
+        trace_record(disk, TRACE_OP_IOCTL, cmd, arg != NULL ? *(int *)arg : 0);
+    else
+        trace_record(disk, TRACE_OP_IOCTL, cmd, 0);
     switch (cmd)
     {
     case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
-        memcpy(arg, &disk.layout_size, sizeof(int));
+        size = disk->layout_size > INT_MAX ? INT_MAX : (int)disk->layout_size;
+        memcpy(arg, &size, sizeof(int));
+        break;
+    case IOC_REQ_DEVICE_SIZE64:                       /* Device Size, 64 bit */
+        size64 = disk->layout_size;
+        memcpy(arg, &size64, sizeof(long long));
         break;
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
+        state.read_cnt = (int)ATOMIC_LOAD(disk->read_cnt);
+        state.write_cnt = (int)ATOMIC_LOAD(disk->write_cnt);
+        state.seek_cnt = (int)ATOMIC_LOAD(disk->seek_cnt);
+        state.queue_depth = disk->queue_depth;
+        state.inflight = aio_inflight(disk);
         memcpy(arg, &state, sizeof(struct ddriver_state));
         break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
-        lseek(fd, 0, SEEK_SET);
-        char buf[1] = {'\0'};
-        for (size_t i = 0; i < CONFIG_DISK_SZ; i++)
-        {
-            write(fd, buf, 1);
+        pthread_rwlock_wrlock(&disk->io_lock);         /* Drain synchronous IO */
+        if (aio_inflight(disk) > 0) {
+            pthread_rwlock_unlock(&disk->io_lock);
+            user_alert("reset with %d async requests in flight", aio_inflight(disk));
+            return -EBUSY;
         }
-        lseek(fd, 0, SEEK_SET);
-        disk.read_cnt = 0;
-        disk.write_cnt = 0;
-        disk.seek_cnt = 0;
+        if (disk->cache != NULL)
+            cache_discard(disk, 0, disk->layout_size);
+        if (discard_range(disk, 0, disk->layout_size) == 0)
+            elide_zero(disk, 0, disk->layout_size);
+        else
+            elide_invalidate(disk, 0, disk->layout_size);
+        ATOMIC_STORE(disk->cursor, 0);
+        stat_reset(disk);
+        pthread_rwlock_unlock(&disk->io_lock);
         break;
     case IOC_REQ_DEVICE_IO_SZ:
-        memcpy(arg, &disk.iounit_size, sizeof(int));
+        memcpy(arg, &disk->iounit_size, sizeof(int));
         break;
+    case IOC_REQ_DEVICE_TAG:                          /* Tag later requests of this thread */
+        return stat_set_tag(arg != NULL ? *(int *)arg : 0);
+    case IOC_REQ_DEVICE_SNAPSHOT:                     /* Snapshot the image */
+    case IOC_REQ_DEVICE_ROLLBACK:                     /* Roll the image back to it */
+        pthread_rwlock_wrlock(&disk->io_lock);
+        if (aio_inflight(disk) > 0) {
+            pthread_rwlock_unlock(&disk->io_lock);
+            return -EBUSY;
+        }
+        size = cmd == IOC_REQ_DEVICE_SNAPSHOT ? snap_take(disk) : snap_rollback(disk);
+        if (cmd == IOC_REQ_DEVICE_ROLLBACK)
+            elide_invalidate(disk, 0, disk->layout_size);
+        pthread_rwlock_unlock(&disk->io_lock);
+        return size;
+    case IOC_REQ_DEVICE_ATOMIC_WRITE:                 /* All-or-nothing multi-block write */
+        pthread_rwlock_wrlock(&disk->io_lock);
+        if (aio_inflight(disk) > 0) {
+            pthread_rwlock_unlock(&disk->io_lock);
+            return -EBUSY;
+        }
+        size = redo_atomic_write(disk, (struct ddriver_atomic_write *)arg);
+        pthread_rwlock_unlock(&disk->io_lock);
+        return size;
+    case IOC_REQ_DEVICE_SYNC:                         /* Flush to backing image */
+        if (IS_MAPPED(disk))
+            return msync(disk->map, disk->layout_size, MS_SYNC);
+        if (disk->cache != NULL && (size = cache_flush(disk)) < 0)
+            return size;
+        return fsync(fd);
+    case IOC_REQ_DEVICE_FLUSH:                        /* Drain write-back cache, or barrier */
+        flags = arg != NULL ? *(int *)arg : 0;
+        if (disk->cache == NULL)
+            return 0;
+        if (flags & DDRIVER_FLUSH_BARRIER) {
+            cache_barrier(disk);
+            return 0;
+        }
+        return cache_flush(disk);
+    case IOC_REQ_DEVICE_STATE_EXT:                    /* Extended, versioned state */
+        return stat_fill_ext(disk, (struct ddriver_state_ext *)arg);
+    case IOC_REQ_DEVICE_HEATMAP:                      /* Per IO unit access counts */
+        return heat_fill(disk, (struct ddriver_heatmap *)arg);
+    case IOC_REQ_DEVICE_DISCARD:                      /* TRIM a range */
+        discard = (struct ddriver_discard *)arg;
+        if (check_pio(disk, discard->offset, discard->len) < 0)
+            return -EINVAL;
+        IO_BEGIN(disk);
+        if (disk->cache != NULL)
+            cache_discard(disk, discard->offset, discard->len);
+        size = discard_range(disk, discard->offset, discard->len);
+        if (size == 0)
+            elide_zero(disk, discard->offset, discard->len);
+        else
+            elide_invalidate(disk, discard->offset, discard->len);
+        IO_END(disk);
+        return size;
     default:
         break;
     }
     return 0;
-}
\ No newline at end of file
+}
+/**
+ * @brief 定位读，不依赖也不移动fd的文件偏移，可多线程并发调用
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size IO单位的整数倍
+ * @param offset 与IO单位对齐的设备偏移
+ * @return int 读出字节数
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset){
+    struct ddriver *disk = dev_get(fd);
+    int res;
+
+    if (disk == NULL)
+        return -EBADF;
+    if ((res = check_pio(disk, offset, size)) < 0)
+        return res;
+    return do_io(disk, DDRIVER_OP_READ, buf, size, offset);
+}
+/**
+ * @brief 定位写，不依赖也不移动fd的文件偏移，可多线程并发调用
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size IO单位的整数倍
+ * @param offset 与IO单位对齐的设备偏移
+ * @return int 写入字节数
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset){
+    struct ddriver *disk = dev_get(fd);
+    int res;
+
+    if (disk == NULL)
+        return -EBADF;
+    if ((res = check_pio(disk, offset, size)) < 0)
+        return res;
+    return do_io(disk, DDRIVER_OP_WRITE, buf, size, offset);
+}
+/**
+ * @brief 多块读，从第lba个IO单位起连续读出blks个单位，仅一次系统调用
+ * 
+ * @param fd 
+ * @param lba 起始IO单位号
+ * @param blks IO单位个数
+ * @param buf 至少blks * IO单位字节
+ * @return int 读出字节数
+ */
+int ddriver_read_blocks(int fd, off_t lba, int blks, char *buf){
+    struct ddriver *disk = dev_get(fd);
+
+    if (disk == NULL)
+        return -EBADF;
+    if (blks <= 0)
+        return check_range(disk, lba, blks);
+    return ddriver_pread(fd, buf, (size_t)blks * disk->iounit_size, 
+                         lba * disk->iounit_size);
+}
+/**
+ * @brief 多块写，从第lba个IO单位起连续写入blks个单位，仅一次系统调用
+ * 
+ * @param fd 
+ * @param lba 起始IO单位号
+ * @param blks IO单位个数
+ * @param buf 至少blks * IO单位字节
+ * @return int 写入字节数
+ */
+int ddriver_write_blocks(int fd, off_t lba, int blks, char *buf){
+    struct ddriver *disk = dev_get(fd);
+
+    if (disk == NULL)
+        return -EBADF;
+    if (blks <= 0)
+        return check_range(disk, lba, blks);
+    return ddriver_pwrite(fd, buf, (size_t)blks * disk->iounit_size, 
+                          lba * disk->iounit_size);
+}
+/**
+ * @brief mmap模式下直接返回某个IO单位在映射中的地址，免去一次拷贝
+ * 
+ * @param fd 
+ * @param offset 与IO单位对齐的设备偏移
+ * @return const char* 非mmap模式或偏移非法时返回NULL
+ */
+const char *ddriver_block_ptr(int fd, off_t offset){
+    struct ddriver *disk = dev_get(fd);
+
+    if (disk == NULL || !IS_MAPPED(disk) || check_pio(disk, offset, disk->iounit_size) < 0)
+        return NULL;
+
+    trace_record(disk, TRACE_OP_READ, offset, disk->iounit_size);
+    stat_io(disk, DDRIVER_OP_READ, offset, disk->iounit_size);
+    return disk->map + offset;
+}
@@ -0,0 +1,605 @@
+#define _GNU_SOURCE
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include <errno.h>
+#include "string.h"
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "ddriver_internal.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define ENV_AIO             "DDRIVER_AIO"               /* "pool" forces the thread pool */
+#define CONFIG_AIO_THREADS  (4)
+#define CONFIG_AIO_SLICE_MS (10)                        /* Longest single wait in uring reap */
+#define AIO_TIMEOUT_TAG     ((__u64)-1)                 /* user_data of timeout SQEs */
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+enum aio_backend {
+    AIO_NONE,                                         /* Not set up yet */
+    AIO_URING,                                        /* io_uring, raw syscalls */
+    AIO_POOL,                                         /* pread/pwrite worker threads */
+    AIO_SYNC                                          /* mmap mode, done at submit */
+};
+
+struct aio_slot
+{
+    struct ddriver_req req;
+    struct iovec       iov;                           /* READV/WRITEV vector */
+    unsigned long long submit_ns;                     /* For latency histogram */
+    int                tag;                           /* Submitting thread's tag */
+    int                next;                          /* Free list / pending queue link */
+};
+
+struct aio_uring
+{
+    int                  ring_fd;
+    unsigned            *sq_head;
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void                *sq_ptr;
+    void                *cq_ptr;
+    size_t               sq_sz;
+    size_t               cq_sz;
+    size_t               sqes_sz;
+};
+
+struct aio_ctx
+{
+    enum aio_backend   backend;
+    int                depth;
+    int                inflight;                      /* Submitted, not reaped yet */
+    struct aio_slot   *slots;
+    int                free_slot;                     /* Head of free slot list */
+    struct aio_uring   ring;
+    pthread_mutex_t    lock;                          /* Guards everything above and below */
+                                                      /* Thread pool and software CQ */
+    pthread_cond_t     work;
+    pthread_cond_t     done;
+    pthread_t          workers[CONFIG_AIO_THREADS];
+    int                nworkers;
+    int                pending_head;                  /* FIFO of slots to execute */
+    int                pending_tail;
+    int                stop;
+    struct ddriver_cpl *cq;
+    int                cq_head;
+    int                cq_cnt;
+};
+/******************************************************************************
+* SECTION: Slot and software completion queue
+*******************************************************************************/
+static int slot_get(struct aio_ctx *aio) {
+    int idx = aio->free_slot;
+    aio->free_slot = aio->slots[idx].next;
+    return idx;
+}
+
+static void slot_put(struct aio_ctx *aio, int idx) {
+    aio->slots[idx].next = aio->free_slot;
+    aio->free_slot = idx;
+}
+
+static void cq_push(struct aio_ctx *aio, void *user_data, int res) {
+    int tail = (aio->cq_head + aio->cq_cnt) % aio->depth;
+    aio->cq[tail].user_data = user_data;
+    aio->cq[tail].res       = res;
+    aio->cq_cnt++;
+}
+
+static int cq_pop(struct aio_ctx *aio, struct ddriver_cpl *cpls, int max) {
+    int got = 0;
+    while (aio->cq_cnt > 0 && got < max) {
+        cpls[got++] = aio->cq[aio->cq_head];
+        aio->cq_head = (aio->cq_head + 1) % aio->depth;
+        aio->cq_cnt--;
+    }
+    return got;
+}
+
+static int exec_req(struct ddriver *disk, struct ddriver_req *req) {
+    ssize_t ret;
+    if (IS_MAPPED(disk)) {
+        if (req->op == DDRIVER_OP_READ)
+            memcpy(req->buf, disk->map + req->offset, req->size);
+        else
+            memcpy(disk->map + req->offset, req->buf, req->size);
+        return req->size;
+    }
+    if (req->op == DDRIVER_OP_READ)
+        ret = image_read(disk, req->buf, req->size, req->offset);
+    else
+        ret = image_write(disk, req->buf, req->size, req->offset);
+    return (int)ret;
+}
+/******************************************************************************
+* SECTION: io_uring backend
+*******************************************************************************/
+static int uring_setup(struct aio_ctx *aio, int entries) {
+    struct io_uring_params p;
+    struct aio_uring *r = &aio->ring;
+    void *ptr;
+
+    memset(&p, 0, sizeof(p));
+    r->ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->ring_fd < 0)
+        return -errno;
+
+    r->sq_sz   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_sz   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_sz > r->sq_sz)
+            r->sq_sz = r->cq_sz;
+        r->cq_sz = r->sq_sz;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_sz, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        goto fail_ring;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    }
+    else {
+        r->cq_ptr = mmap(NULL, r->cq_sz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+            goto fail_sq;
+    }
+    ptr = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED)
+        goto fail_cq;
+    r->sqes = ptr;
+
+    r->sq_head  = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+    r->sq_tail  = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask  = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+    r->cq_head  = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail  = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask  = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+    return 0;
+
+fail_cq:
+    if (r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_sz);
+fail_sq:
+    munmap(r->sq_ptr, r->sq_sz);
+fail_ring:
+    close(r->ring_fd);
+    return -ENOMEM;
+}
+
+static void uring_teardown(struct aio_ctx *aio) {
+    struct aio_uring *r = &aio->ring;
+    munmap(r->sqes, r->sqes_sz);
+    if (r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_sz);
+    munmap(r->sq_ptr, r->sq_sz);
+    close(r->ring_fd);
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct aio_ctx *aio) {
+    struct aio_uring *r = &aio->ring;
+    unsigned tail = *r->sq_tail;
+    unsigned idx  = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+static int uring_enter(struct aio_ctx *aio, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    int ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, aio->ring.ring_fd, to_submit,
+                      min_complete, flags, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret < 0 ? -errno : ret;
+}
+
+static int uring_drain(struct ddriver *disk, struct ddriver_cpl *cpls, int max) {
+    struct aio_ctx *aio = disk->aio;
+    struct aio_uring *r = &aio->ring;
+    struct aio_slot *slot;
+    unsigned head = *r->cq_head;
+    int got = 0;
+
+    while (got < max && head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        head++;
+        if (cqe->user_data == AIO_TIMEOUT_TAG)
+            continue;
+        slot = &aio->slots[cqe->user_data];
+        cpls[got].user_data = slot->req.user_data;
+        cpls[got].res       = cqe->res;
+        stat_latency(disk, slot->req.op == DDRIVER_OP_READ ? DDRIVER_LAT_READ : DDRIVER_LAT_WRITE,
+                     slot->submit_ns);
+        stat_tag(disk, slot->tag, slot->req.op, slot->req.size, slot->submit_ns);
+        slot_put(aio, (int)cqe->user_data);
+        got++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    return got;
+}
+
+static int uring_submit(struct ddriver *disk, struct ddriver_req *reqs, int n) {
+    struct aio_ctx *aio = disk->aio;
+    struct io_uring_sqe *sqe;
+    int i, idx;
+
+    for (i = 0; i < n; i++) {
+        idx = slot_get(aio);
+        aio->slots[idx].req          = reqs[i];
+        aio->slots[idx].submit_ns    = stat_now();
+        aio->slots[idx].tag          = stat_get_tag();
+        aio->slots[idx].iov.iov_base = reqs[i].buf;
+        aio->slots[idx].iov.iov_len  = reqs[i].size;
+
+        sqe = uring_get_sqe(aio);
+        sqe->opcode    = reqs[i].op == DDRIVER_OP_READ ? IORING_OP_READV
+                                                       : IORING_OP_WRITEV;
+        sqe->fd        = disk->ddriver_fd;
+        sqe->addr      = (unsigned long)&aio->slots[idx].iov;
+        sqe->len       = 1;
+        sqe->off       = reqs[i].offset;
+        sqe->user_data = idx;
+    }
+    return uring_enter(aio, n, 0, 0);
+}
+
+/**
+ * @brief 持aio->lock调用，等待期间释放锁，以便其他线程并发提交。
+ * 每次最多等待CONFIG_AIO_SLICE_MS，避免完成项被其他收割线程取走后一直阻塞
+ */
+static int uring_reap(struct ddriver *disk, struct ddriver_cpl *cpls, int max,
+                      int timeout_ms) {
+    struct aio_ctx *aio = disk->aio;
+    struct __kernel_timespec ts;
+    struct io_uring_sqe *sqe;
+    int slice;
+    int got = uring_drain(disk, cpls, max);
+
+    while (got == 0 && timeout_ms != 0 && aio->inflight > 0) {
+        slice = timeout_ms < 0 || timeout_ms > CONFIG_AIO_SLICE_MS ? CONFIG_AIO_SLICE_MS
+                                                                   : timeout_ms;
+        ts.tv_sec  = 0;
+        ts.tv_nsec = slice * 1000000L;
+        sqe = uring_get_sqe(aio);
+        sqe->opcode    = IORING_OP_TIMEOUT;
+        sqe->addr      = (unsigned long)&ts;
+        sqe->len       = 1;
+        sqe->off       = 1;                           /* Fire on first completion */
+        sqe->user_data = AIO_TIMEOUT_TAG;
+        uring_enter(aio, 1, 0, 0);                         /* Kernel copies ts at submission */
+
+        pthread_mutex_unlock(&aio->lock);
+        uring_enter(aio, 0, 1, IORING_ENTER_GETEVENTS);
+        pthread_mutex_lock(&aio->lock);
+
+        got = uring_drain(disk, cpls, max);
+        if (timeout_ms > 0)
+            timeout_ms -= slice;
+    }
+    return got;
+}
+/******************************************************************************
+* SECTION: Thread pool backend
+*******************************************************************************/
+static void *pool_worker(void *arg) {
+    struct ddriver *disk = (struct ddriver *)arg;
+    struct aio_ctx *aio = disk->aio;
+    struct ddriver_req req;
+    unsigned long long submit_ns;
+    int idx, res, tag;
+
+    pthread_mutex_lock(&aio->lock);
+    for (;;) {
+        while (aio->pending_head < 0 && !aio->stop)
+            pthread_cond_wait(&aio->work, &aio->lock);
+        if (aio->pending_head < 0)
+            break;
+        idx = aio->pending_head;
+        aio->pending_head = aio->slots[idx].next;
+        if (aio->pending_head < 0)
+            aio->pending_tail = -1;
+        req = aio->slots[idx].req;
+        submit_ns = aio->slots[idx].submit_ns;
+        tag = aio->slots[idx].tag;
+        pthread_mutex_unlock(&aio->lock);
+
+        res = exec_req(disk, &req);
+
+        pthread_mutex_lock(&aio->lock);
+        cq_push(aio, req.user_data, res);
+        stat_latency(disk, req.op == DDRIVER_OP_READ ? DDRIVER_LAT_READ : DDRIVER_LAT_WRITE,
+                     submit_ns);
+        stat_tag(disk, tag, req.op, req.size, submit_ns);
+        slot_put(aio, idx);
+        pthread_cond_signal(&aio->done);
+    }
+    pthread_mutex_unlock(&aio->lock);
+    return NULL;
+}
+
+static int pool_setup(struct ddriver *disk) {
+    struct aio_ctx *aio = disk->aio;
+    aio->pending_head = aio->pending_tail = -1;
+    aio->stop = 0;
+    for (aio->nworkers = 0; aio->nworkers < CONFIG_AIO_THREADS; aio->nworkers++) {
+        if (pthread_create(&aio->workers[aio->nworkers], NULL, pool_worker, disk) != 0)
+            break;
+    }
+    return aio->nworkers > 0 ? 0 : -EAGAIN;
+}
+
+static void pool_teardown(struct aio_ctx *aio) {
+    int i;
+    pthread_mutex_lock(&aio->lock);
+    aio->stop = 1;
+    pthread_cond_broadcast(&aio->work);
+    pthread_mutex_unlock(&aio->lock);
+    for (i = 0; i < aio->nworkers; i++)
+        pthread_join(aio->workers[i], NULL);
+}
+
+static void pool_submit(struct aio_ctx *aio, struct ddriver_req *reqs, int n) {
+    int i, idx;
+    for (i = 0; i < n; i++) {
+        idx = slot_get(aio);
+        aio->slots[idx].req       = reqs[i];
+        aio->slots[idx].submit_ns = stat_now();
+        aio->slots[idx].tag       = stat_get_tag();
+        aio->slots[idx].next = -1;
+        if (aio->pending_tail < 0)
+            aio->pending_head = idx;
+        else
+            aio->slots[aio->pending_tail].next = idx;
+        aio->pending_tail = idx;
+    }
+    pthread_cond_broadcast(&aio->work);
+}
+
+static int pool_reap(struct aio_ctx *aio, struct ddriver_cpl *cpls, int max,
+                     int timeout_ms) {
+    struct timespec deadline;
+
+    if (timeout_ms > 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec  += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    while (aio->cq_cnt == 0 && timeout_ms != 0) {
+        if (timeout_ms < 0)
+            pthread_cond_wait(&aio->done, &aio->lock);
+        else if (pthread_cond_timedwait(&aio->done, &aio->lock, &deadline) == ETIMEDOUT)
+            break;
+    }
+    return cq_pop(aio, cpls, max);
+}
+/******************************************************************************
+* SECTION: Setup and teardown
+*******************************************************************************/
+static int aio_setup(struct ddriver *disk) {
+    struct aio_ctx *aio = disk->aio;
+    char *env = getenv(ENV_AIO);
+    int i;
+
+    aio->depth     = disk->queue_depth;
+    aio->inflight  = 0;
+    aio->cq_head   = 0;
+    aio->cq_cnt    = 0;
+    aio->slots     = (struct aio_slot *)malloc(aio->depth * sizeof(struct aio_slot));
+    aio->cq        = (struct ddriver_cpl *)malloc(aio->depth * sizeof(struct ddriver_cpl));
+    if (aio->slots == NULL || aio->cq == NULL)
+        return -ENOMEM;
+    for (i = 0; i < aio->depth; i++)
+        aio->slots[i].next = i + 1 < aio->depth ? i + 1 : -1;
+    aio->free_slot = 0;
+
+    if (IS_MAPPED(disk)) {
+        aio->backend = AIO_SYNC;
+    }
+    else if ((env == NULL || strcmp(env, "pool") != 0) && disk->image == NULL &&
+             uring_setup(aio, aio->depth) == 0) {
+        aio->backend = AIO_URING;
+    }
+    else {
+        if (pool_setup(disk) < 0) {
+            free(aio->slots);
+            free(aio->cq);
+            return -EAGAIN;
+        }
+        aio->backend = AIO_POOL;
+    }
+    user_info("async io backend %s, queue depth %d",
+              aio->backend == AIO_URING ? "io_uring" :
+              aio->backend == AIO_POOL  ? "thread pool" : "mmap", aio->depth);
+    return 0;
+}
+/**
+ * @brief 打开设备时调用，只分配上下文，队列与后端在第一次提交时再建立
+ *
+ * @return int
+ */
+int aio_init(struct ddriver *disk) {
+    struct aio_ctx *aio = (struct aio_ctx *)calloc(1, sizeof(struct aio_ctx));
+
+    if (aio == NULL)
+        return -ENOMEM;
+    aio->backend = AIO_NONE;
+    pthread_mutex_init(&aio->lock, NULL);
+    pthread_cond_init(&aio->work, NULL);
+    pthread_cond_init(&aio->done, NULL);
+    disk->aio = aio;
+    return 0;
+}
+/**
+ * @brief 关闭设备前调用，等待所有在途请求完成并释放队列
+ */
+void aio_teardown(struct ddriver *disk) {
+    struct aio_ctx *aio = disk->aio;
+    struct ddriver_cpl cpl;
+
+    if (aio == NULL)
+        return;
+    if (aio->backend != AIO_NONE) {
+        while (aio->inflight > 0)
+            ddriver_reap(disk->ddriver_fd, &cpl, 1, -1);
+        if (aio->backend == AIO_URING)
+            uring_teardown(aio);
+        else if (aio->backend == AIO_POOL)
+            pool_teardown(aio);
+        free(aio->slots);
+        free(aio->cq);
+    }
+    pthread_mutex_destroy(&aio->lock);
+    pthread_cond_destroy(&aio->work);
+    pthread_cond_destroy(&aio->done);
+    free(aio);
+    disk->aio = NULL;
+}
+
+int aio_inflight(struct ddriver *disk) {
+    return ATOMIC_LOAD(disk->aio->inflight);
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 异步提交一批请求，不等待完成。队列满时只接收一部分，调用者需先reap再重提剩余部分。
+ * 可与ddriver_reap及其他提交线程并发调用
+ *
+ * @param fd
+ * @param reqs
+ * @param n
+ * @return int 实际接收的请求数，负数表示失败(整批都未提交)
+ */
+int ddriver_submit(int fd, struct ddriver_req *reqs, int n) {
+    struct ddriver *disk = dev_get(fd);
+    struct aio_ctx *aio;
+    int i, res = 0;
+
+    if (disk == NULL)
+        return -EBADF;
+    aio = disk->aio;
+
+    for (i = 0; i < n; i++) {
+        if (reqs[i].op != DDRIVER_OP_READ && reqs[i].op != DDRIVER_OP_WRITE)
+            return -EINVAL;
+        if ((res = check_pio(disk, reqs[i].offset, reqs[i].size)) < 0)
+            return res;
+    }
+
+    IO_BEGIN(disk);                                   /* Reset waits until inflight is reaped */
+    if (disk->cache != NULL && (res = cache_flush(disk)) < 0) {
+        IO_END(disk);                                 /* Async IO bypasses the write-back cache */
+        return res;
+    }
+    pthread_mutex_lock(&aio->lock);
+    if (aio->backend == AIO_NONE && (res = aio_setup(disk)) < 0)
+        goto out;
+    if (n > aio->depth - aio->inflight)
+        n = aio->depth - aio->inflight;
+    for (i = 0; i < n; i++) {                         /* Undo log saves before the write lands */
+        if (reqs[i].op == DDRIVER_OP_WRITE &&
+            (res = snap_preserve(disk, reqs[i].offset, reqs[i].size)) < 0)
+            goto out;
+    }
+    for (i = 0; i < n; i++) {                         /* Async writes are never elided */
+        if (reqs[i].op == DDRIVER_OP_WRITE)
+            elide_invalidate(disk, reqs[i].offset, reqs[i].size);
+    }
+
+    for (i = 0; i < n; i++) {                         /* Device sees them in submit order */
+        trace_record(disk, reqs[i].op == DDRIVER_OP_READ ? TRACE_OP_READ : TRACE_OP_WRITE,
+                     reqs[i].offset, reqs[i].size);
+        stat_io(disk, reqs[i].op, reqs[i].offset, reqs[i].size);
+    }
+
+    switch (aio->backend)
+    {
+    case AIO_URING:
+        if ((res = uring_submit(disk, reqs, n)) < 0)
+            goto out;
+        break;
+    case AIO_POOL:
+        pool_submit(aio, reqs, n);
+        break;
+    default:
+        for (i = 0; i < n; i++) {
+            unsigned long long start = stat_now();
+            cq_push(aio, reqs[i].user_data, exec_req(disk, &reqs[i]));
+            stat_latency(disk, reqs[i].op == DDRIVER_OP_READ ? DDRIVER_LAT_READ
+                                                             : DDRIVER_LAT_WRITE, start);
+            stat_tag(disk, stat_get_tag(), reqs[i].op, reqs[i].size, start);
+        }
+        break;
+    }
+    ATOMIC_STORE(aio->inflight, aio->inflight + n);
+    res = n;
+out:
+    pthread_mutex_unlock(&aio->lock);
+    IO_END(disk);
+    return res;
+}
+/**
+ * @brief 收割已完成的请求，可多线程并发调用，每个完成项只交给其中一个线程
+ *
+ * @param fd
+ * @param cpls
+ * @param max
+ * @param timeout_ms 0立即返回，负数一直等到至少一个完成
+ * @return int 收割到的完成数
+ */
+int ddriver_reap(int fd, struct ddriver_cpl *cpls, int max, int timeout_ms) {
+    struct ddriver *disk = dev_get(fd);
+    struct aio_ctx *aio;
+    int got;
+
+    if (disk == NULL)
+        return -EBADF;
+    aio = disk->aio;
+
+    pthread_mutex_lock(&aio->lock);
+    if (aio->backend == AIO_NONE || aio->inflight == 0 || max <= 0) {
+        pthread_mutex_unlock(&aio->lock);
+        return 0;
+    }
+
+    switch (aio->backend)
+    {
+    case AIO_URING:
+        got = uring_reap(disk, cpls, max, timeout_ms);
+        break;
+    case AIO_POOL:
+        got = pool_reap(aio, cpls, max, timeout_ms);
+        break;
+    default:
+        got = cq_pop(aio, cpls, max);
+        break;
+    }
+    ATOMIC_STORE(aio->inflight, aio->inflight - got);
+    pthread_mutex_unlock(&aio->lock);
+    return got;
+}
@@ -0,0 +1,301 @@
+#define _GNU_SOURCE                                     /* pwritev, IOV_MAX, qsort_r */
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include <errno.h>
+#include "string.h"
+#include <limits.h>
+#include <sys/uio.h>
+#include "ddriver_internal.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define CACHE_NIL           (-1)
+#define CACHE_HASH(lba)     ((int)(((unsigned long long)(lba) * 0x9E3779B97F4A7C15ULL) >> 32) \
+                             & (cache->nbuckets - 1))
+#define ENTRY_DATA(idx)     (cache->data + (size_t)(idx) * disk->iounit_size)
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+struct cache_entry
+{
+    off_t    lba;                                     /* In IO units */
+    unsigned epoch;                                   /* Barrier epoch of the last write */
+    int      next;                                    /* Hash chain / free list link */
+};
+
+struct wb_cache
+{
+    int                 nunits;
+    int                 nbuckets;                     /* Power of 2 */
+    int                 used;
+    int                 free_head;
+    unsigned            epoch;                        /* Bumped by every barrier */
+    int                 epoch_dirty;                  /* Current epoch has writes */
+    struct cache_entry *entries;
+    int                *buckets;
+    int                *order;                        /* Scratch for flush sorting */
+    struct iovec       *iov;                          /* Scratch for flush merging, IOV_MAX */
+    char               *data;                         /* nunits * iounit_size */
+    pthread_mutex_t     lock;
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static void cache_clear(struct wb_cache *cache) {
+    int i;
+    for (i = 0; i < cache->nbuckets; i++)
+        cache->buckets[i] = CACHE_NIL;
+    for (i = 0; i < cache->nunits; i++)
+        cache->entries[i].next = i + 1 < cache->nunits ? i + 1 : CACHE_NIL;
+    cache->free_head   = 0;
+    cache->used        = 0;
+    cache->epoch       = 0;
+    cache->epoch_dirty = 0;
+}
+
+static int cache_lookup(struct wb_cache *cache, off_t lba) {
+    int idx = cache->buckets[CACHE_HASH(lba)];
+    while (idx != CACHE_NIL && cache->entries[idx].lba != lba)
+        idx = cache->entries[idx].next;
+    return idx;
+}
+
+static int cache_insert(struct wb_cache *cache, off_t lba) {
+    int idx = cache->free_head;
+    int *bucket = &cache->buckets[CACHE_HASH(lba)];
+
+    cache->free_head = cache->entries[idx].next;
+    cache->entries[idx].lba  = lba;
+    cache->entries[idx].next = *bucket;
+    *bucket = idx;
+    cache->used++;
+    return idx;
+}
+
+static int cache_cmp(const void *a, const void *b, void *arg) {
+    struct wb_cache *cache = (struct wb_cache *)arg;
+    const struct cache_entry *x = &cache->entries[*(const int *)a];
+    const struct cache_entry *y = &cache->entries[*(const int *)b];
+    if (x->epoch != y->epoch)
+        return x->epoch < y->epoch ? -1 : 1;
+    return x->lba < y->lba ? -1 : x->lba > y->lba;
+}
+/**
+ * @brief 刷回全部脏单位：按(屏障epoch, lba)排序，同一epoch内相邻单位合并为一次pwritev，
+ * epoch之间fdatasync，保证屏障前的写先于屏障后的写落盘。需持cache->lock
+ *
+ * @return int 0成功，失败返回-errno且缓存保持不变
+ */
+static int cache_flush_locked(struct ddriver *disk) {
+    struct wb_cache *cache = disk->cache;
+    struct iovec *iov = cache->iov;
+    int i, j, n = 0, cnt, ret;
+    off_t start;
+
+    if (cache->used == 0)
+        return 0;
+    for (i = 0; i < cache->nbuckets; i++)
+        for (j = cache->buckets[i]; j != CACHE_NIL; j = cache->entries[j].next)
+            cache->order[n++] = j;
+    qsort_r(cache->order, n, sizeof(int), cache_cmp, cache);
+
+    for (i = 0; i < n; i += cnt) {
+        struct cache_entry *head = &cache->entries[cache->order[i]];
+        if (i > 0 && cache->entries[cache->order[i - 1]].epoch != head->epoch &&
+            fdatasync(disk->ddriver_fd) < 0)
+            return -errno;
+
+        start = head->lba;
+        for (cnt = 0; i + cnt < n && cnt < IOV_MAX; cnt++) {
+            struct cache_entry *e = &cache->entries[cache->order[i + cnt]];
+            if (e->epoch != head->epoch || e->lba != start + cnt)
+                break;
+            iov[cnt].iov_base = ENTRY_DATA(cache->order[i + cnt]);
+            iov[cnt].iov_len  = disk->iounit_size;
+        }
+        if ((ret = snap_preserve(disk, start * disk->iounit_size,
+                                 (off_t)cnt * disk->iounit_size)) < 0)
+            return ret;
+        if ((ret = image_writev(disk, iov, cnt, start * disk->iounit_size)) < 0)
+            return ret;
+        stat_io(disk, DDRIVER_OP_WRITE, start * disk->iounit_size,
+                      (size_t)cnt * disk->iounit_size);
+        ATOMIC_ADD(disk->cache_flush_runs, 1);
+    }
+    cache_clear(cache);
+    return 0;
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 打开设备时调用，按字节数分配写回缓存，不足一个IO单位则不开启
+ *
+ * @param size
+ * @return int
+ */
+int cache_setup(struct ddriver *disk, long long size) {
+    struct wb_cache *cache;
+    int nunits = size / disk->iounit_size;
+
+    if (nunits <= 0)
+        return 0;
+    if ((cache = (struct wb_cache *)calloc(1, sizeof(struct wb_cache))) == NULL)
+        return -ENOMEM;
+    cache->nunits = nunits;
+    for (cache->nbuckets = 1; cache->nbuckets < cache->nunits; cache->nbuckets <<= 1)
+        ;
+    pthread_mutex_init(&cache->lock, NULL);
+    disk->cache = cache;
+    cache->entries = (struct cache_entry *)malloc(cache->nunits * sizeof(struct cache_entry));
+    cache->order   = (int *)malloc(cache->nunits * sizeof(int));
+    cache->buckets = (int *)malloc(cache->nbuckets * sizeof(int));
+    cache->iov     = (struct iovec *)malloc(IOV_MAX * sizeof(struct iovec));
+    cache->data    = (char *)malloc((size_t)cache->nunits * disk->iounit_size);
+    if (!cache->entries || !cache->order || !cache->buckets || !cache->iov || !cache->data) {
+        cache_teardown(disk);
+        return -ENOMEM;
+    }
+    cache_clear(cache);
+    return 0;
+}
+/**
+ * @brief 刷回并释放缓存
+ */
+void cache_teardown(struct ddriver *disk) {
+    struct wb_cache *cache = disk->cache;
+
+    if (cache == NULL)
+        return;
+    if (cache->data != NULL)
+        cache_flush(disk);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->entries);
+    free(cache->order);
+    free(cache->buckets);
+    free(cache->iov);
+    free(cache->data);
+    free(cache);
+    disk->cache = NULL;
+}
+/**
+ * @brief 写入缓存，不落盘。覆盖屏障之前写入的单位时，先刷回旧数据以维持顺序；
+ * 缓存满时整体刷回
+ *
+ * @param buf
+ * @param size
+ * @param offset
+ * @return int 写入字节数
+ */
+int cache_write(struct ddriver *disk, const char *buf, size_t size, off_t offset) {
+    struct wb_cache *cache = disk->cache;
+    off_t lba = offset / disk->iounit_size;
+    int i, idx, ret = 0;
+    int blks = size / disk->iounit_size;
+
+    pthread_mutex_lock(&cache->lock);
+    for (i = 0; i < blks; i++) {
+        idx = cache_lookup(cache, lba + i);
+        if (idx != CACHE_NIL && cache->entries[idx].epoch != cache->epoch) {
+            if ((ret = cache_flush_locked(disk)) < 0)
+                break;
+            idx = CACHE_NIL;
+        }
+        if (idx != CACHE_NIL) {
+            ATOMIC_ADD(disk->cache_write_hits, 1);
+        }
+        else {
+            if (cache->used == cache->nunits && (ret = cache_flush_locked(disk)) < 0)
+                break;
+            idx = cache_insert(cache, lba + i);
+        }
+        memcpy(ENTRY_DATA(idx), buf + (size_t)i * disk->iounit_size, disk->iounit_size);
+        cache->entries[idx].epoch = cache->epoch;
+        cache->epoch_dirty = 1;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return ret < 0 ? ret : (int)size;
+}
+/**
+ * @brief 读设备并用缓存中的脏单位覆盖，全部命中时不访问设备
+ *
+ * @param buf
+ * @param size
+ * @param offset
+ * @return int 读出字节数
+ */
+int cache_read(struct ddriver *disk, char *buf, size_t size, off_t offset) {
+    struct wb_cache *cache = disk->cache;
+    off_t lba = offset / disk->iounit_size;
+    int i, idx, hits = 0;
+    int blks = size / disk->iounit_size;
+    ssize_t ret = size;
+
+    pthread_mutex_lock(&cache->lock);
+    for (i = 0; i < blks; i++)
+        hits += cache_lookup(cache, lba + i) != CACHE_NIL;
+    if (hits < blks) {
+        if ((ret = image_read(disk, buf, size, offset)) < 0)
+            goto out;
+        stat_io(disk, DDRIVER_OP_READ, offset, size);
+    }
+    for (i = 0; i < blks && hits > 0; i++) {
+        if ((idx = cache_lookup(cache, lba + i)) != CACHE_NIL)
+            memcpy(buf + (size_t)i * disk->iounit_size, ENTRY_DATA(idx), disk->iounit_size);
+    }
+    ATOMIC_ADD(disk->cache_read_hits, hits);
+out:
+    pthread_mutex_unlock(&cache->lock);
+    return (int)ret;
+}
+/**
+ * @brief 插入写屏障：之前写入的单位一定先于之后写入的单位落盘
+ */
+void cache_barrier(struct ddriver *disk) {
+    struct wb_cache *cache = disk->cache;
+    pthread_mutex_lock(&cache->lock);
+    if (cache->epoch_dirty) {
+        cache->epoch++;
+        cache->epoch_dirty = 0;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int cache_flush(struct ddriver *disk) {
+    struct wb_cache *cache = disk->cache;
+    int ret;
+    pthread_mutex_lock(&cache->lock);
+    ret = cache_flush_locked(disk);
+    pthread_mutex_unlock(&cache->lock);
+    return ret;
+}
+/**
+ * @brief 丢弃[offset, offset + len)内的脏单位，不写回
+ *
+ * @param offset
+ * @param len
+ */
+void cache_discard(struct ddriver *disk, off_t offset, off_t len) {
+    struct wb_cache *cache = disk->cache;
+    off_t first = offset / disk->iounit_size;
+    off_t last  = (offset + len) / disk->iounit_size;
+    int i, idx, *link;
+
+    pthread_mutex_lock(&cache->lock);
+    for (i = 0; i < cache->nbuckets; i++) {
+        link = &cache->buckets[i];
+        while ((idx = *link) != CACHE_NIL) {
+            if (cache->entries[idx].lba >= first && cache->entries[idx].lba < last) {
+                *link = cache->entries[idx].next;
+                cache->entries[idx].next = cache->free_head;
+                cache->free_head = idx;
+                cache->used--;
+            }
+            else {
+                link = &cache->entries[idx].next;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,242 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include <errno.h>
+#include "string.h"
+#include <stdint.h>
+#include "ddriver_internal.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define XXH_PRIME1          0x9E3779B185EBCA87ULL
+#define XXH_PRIME2          0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME3          0x165667B19E3779F9ULL
+#define XXH_PRIME4          0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME5          0x27D4EB2F165667C5ULL
+#define ELIDE_UNKNOWN       0                           /* Content not seen since open */
+#define ELIDE_STALE         (~0ULL)                     /* elide_begin: don't learn hashes */
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+struct elide_ctx
+{
+    uint64_t           *hashes;                       /* Per IO unit, ELIDE_UNKNOWN if unknown */
+    uint64_t            zero;                         /* Hash of an all-zero IO unit */
+    unsigned long long  gen;                          /* Bumped on every invalidation */
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static inline uint64_t xxh_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t lane) {
+    acc += lane * XXH_PRIME2;
+    return xxh_rotl(acc, 31) * XXH_PRIME1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+static inline uint64_t xxh_read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t xxh_read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+/**
+ * @brief XXH64，种子为0。小端机器上与参考实现结果一致
+ */
+static uint64_t xxh64(const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data, *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = XXH_PRIME1 + XXH_PRIME2, v2 = XXH_PRIME2, v3 = 0, v4 = -XXH_PRIME1;
+        do {
+            v1 = xxh_round(v1, xxh_read64(p));
+            v2 = xxh_round(v2, xxh_read64(p + 8));
+            v3 = xxh_round(v3, xxh_read64(p + 16));
+            v4 = xxh_round(v4, xxh_read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    }
+    else {
+        h = XXH_PRIME5;
+    }
+    h += len;
+
+    for (; p + 8 <= end; p += 8)
+        h = xxh_rotl(h ^ xxh_round(0, xxh_read64(p)), 27) * XXH_PRIME1 + XXH_PRIME4;
+    if (p + 4 <= end) {
+        h = xxh_rotl(h ^ (xxh_read32(p) * XXH_PRIME1), 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = xxh_rotl(h ^ (*p * XXH_PRIME5), 11) * XXH_PRIME1;
+
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t elide_hash(struct ddriver *disk, const char *unit) {
+    uint64_t h = xxh64(unit, disk->iounit_size);
+    return h == ELIDE_UNKNOWN ? 1 : h;
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 打开设备时调用，每个IO单位一个64位哈希，打开时全部未知
+ *
+ * @return int
+ */
+int elide_setup(struct ddriver *disk) {
+    struct elide_ctx *elide;
+    char *zero;
+
+    if ((elide = (struct elide_ctx *)calloc(1, sizeof(struct elide_ctx))) == NULL)
+        return -ENOMEM;
+    elide->hashes = (uint64_t *)calloc(disk->layout_size / disk->iounit_size, sizeof(uint64_t));
+    zero = (char *)calloc(1, disk->iounit_size);
+    if (elide->hashes == NULL || zero == NULL) {
+        free(zero);
+        free(elide->hashes);
+        free(elide);
+        return -ENOMEM;
+    }
+    elide->zero = elide_hash(disk, zero);
+    free(zero);
+    disk->elide = elide;
+    user_info("write elision, %lld hashes", (long long)(disk->layout_size / disk->iounit_size));
+    return 0;
+}
+
+void elide_teardown(struct ddriver *disk) {
+    struct elide_ctx *elide = disk->elide;
+    if (elide == NULL)
+        return;
+    free(elide->hashes);
+    free(elide);
+    disk->elide = NULL;
+}
+/**
+ * @brief 在读写之前取得代号，elide_record据此判断期间内容是否可能被别处改过。
+ * 写在开始与结束时各推进一次代号，与之重叠的其他读写都不会学到过时的哈希。
+ * 有在途异步请求时，它们可能与本次IO交错落盘，本次不学习哈希
+ *
+ * @param op DDRIVER_OP_READ / DDRIVER_OP_WRITE
+ * @return unsigned long long
+ */
+unsigned long long elide_begin(struct ddriver *disk, int op) {
+    if (disk->elide == NULL)
+        return ELIDE_STALE;
+    if (op == DDRIVER_OP_WRITE)
+        __atomic_fetch_add(&disk->elide->gen, 1, __ATOMIC_ACQ_REL);
+    if (aio_inflight(disk) > 0)
+        return ELIDE_STALE;
+    return __atomic_load_n(&disk->elide->gen, __ATOMIC_ACQUIRE);
+}
+/**
+ * @brief 写之前调用：从buf起逐IO单位比较哈希，跳过开头内容未变的单位，
+ * 再取其后连续变化的一段作为下一次要下发的写。跳过的单位计入write_elided。
+ * 调用者循环调用直到走完整个写，中间未变的单位也不会下发
+ *
+ * @param buf 本轮剩余的数据
+ * @param size 剩余字节数
+ * @param offset 剩余部分的设备偏移
+ * @param run 出: 跳过部分之后要写的字节数，0表示剩余内容全部未变
+ * @return size_t 开头跳过的字节数
+ */
+size_t elide_next(struct ddriver *disk, const char *buf, size_t size, off_t offset, size_t *run) {
+    struct elide_ctx *elide = disk->elide;
+    size_t units, lo, hi;
+    off_t lba;
+
+    if (elide == NULL) {
+        *run = size;
+        return 0;
+    }
+    units = size / disk->iounit_size;
+    lba   = offset / disk->iounit_size;
+    for (lo = 0; lo < units; lo++) {
+        uint64_t old = ATOMIC_LOAD(elide->hashes[lba + lo]);
+        if (old == ELIDE_UNKNOWN || old != elide_hash(disk, buf + lo * disk->iounit_size))
+            break;
+    }
+    for (hi = lo; hi < units; hi++) {
+        uint64_t old = ATOMIC_LOAD(elide->hashes[lba + hi]);
+        if (old != ELIDE_UNKNOWN && old == elide_hash(disk, buf + hi * disk->iounit_size))
+            break;
+    }
+    if (lo > 0)
+        ATOMIC_ADD(disk->write_elided, lo);
+    *run = (hi - lo) * disk->iounit_size;
+    return lo * disk->iounit_size;
+}
+/**
+ * @brief 读写成功之后调用，记下设备上[offset, offset + size)现在的内容。
+ * 代号在期间变过(并发的写、丢弃、回滚)则只作废
+ *
+ * @param gen elide_begin的返回值
+ * @param op 同elide_begin
+ */
+void elide_record(struct ddriver *disk, unsigned long long gen, int op, const char *buf,
+                  size_t size, off_t offset) {
+    struct elide_ctx *elide = disk->elide;
+    off_t lba = offset / disk->iounit_size;
+    size_t i;
+
+    if (elide == NULL)
+        return;
+    if (gen != ELIDE_STALE) {
+        for (i = 0; i < size / disk->iounit_size; i++)
+            ATOMIC_STORE(elide->hashes[lba + i], elide_hash(disk, buf + i * disk->iounit_size));
+    }
+    if (gen == ELIDE_STALE || __atomic_load_n(&elide->gen, __ATOMIC_ACQUIRE) != gen)
+        elide_invalidate(disk, offset, size);
+    else if (op == DDRIVER_OP_WRITE)
+        __atomic_fetch_add(&elide->gen, 1, __ATOMIC_ACQ_REL);
+}
+/**
+ * @brief [offset, offset + len)的内容不再可知：异步写、原子写、回滚时调用
+ */
+void elide_invalidate(struct ddriver *disk, off_t offset, off_t len) {
+    struct elide_ctx *elide = disk->elide;
+    off_t lba;
+
+    if (elide == NULL)
+        return;
+    __atomic_fetch_add(&elide->gen, 1, __ATOMIC_ACQ_REL);
+    for (lba = offset / disk->iounit_size; lba < (offset + len) / disk->iounit_size; lba++)
+        ATOMIC_STORE(elide->hashes[lba], ELIDE_UNKNOWN);
+}
+/**
+ * @brief [offset, offset + len)已被丢弃，之后读出全0
+ */
+void elide_zero(struct ddriver *disk, off_t offset, off_t len) {
+    struct elide_ctx *elide = disk->elide;
+    off_t lba;
+
+    if (elide == NULL)
+        return;
+    __atomic_fetch_add(&elide->gen, 1, __ATOMIC_ACQ_REL);
+    for (lba = offset / disk->iounit_size; lba < (offset + len) / disk->iounit_size; lba++)
+        ATOMIC_STORE(elide->hashes[lba], elide->zero);
+}
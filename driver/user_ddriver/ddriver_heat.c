@@ -0,0 +1,157 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "string.h"
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "ddriver_internal.h"
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+struct heat_ctx
+{
+    int                 fd;
+    size_t              map_size;
+    struct heat_header *hdr;
+    struct heat_ent    *ents;
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+/**
+ * @brief 已有的热度文件与当前几何参数一致时沿用，跨多次挂载累计
+ */
+static int heat_compatible(struct ddriver *disk, struct heat_header *hdr) {
+    return hdr->magic == HEAT_MAGIC && hdr->version == HEAT_VERSION &&
+           hdr->iounit_size == (uint32_t)disk->iounit_size &&
+           hdr->ent_size == sizeof(struct heat_ent) &&
+           hdr->layout_size == (uint64_t)disk->layout_size;
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 打开设备时调用，映射<image>_heat，每个IO单位一项。
+ * 文件已存在且几何参数相同则继续累计，否则重新初始化
+ *
+ * @param path 热度文件路径
+ * @return int
+ */
+int heat_setup(struct ddriver *disk, const char *path) {
+    long long nblks = disk->layout_size / disk->iounit_size;
+    struct heat_ctx *heat;
+    struct stat st;
+    void *map;
+    int ret, fresh;
+
+    if ((heat = (struct heat_ctx *)malloc(sizeof(struct heat_ctx))) == NULL)
+        return -ENOMEM;
+    heat->map_size = sizeof(struct heat_header) + nblks * sizeof(struct heat_ent);
+    heat->fd = open(path, O_CREAT | O_RDWR, 0644);
+    if (heat->fd < 0) {
+        ret = -errno;
+        free(heat);
+        return ret;
+    }
+    fresh = fstat(heat->fd, &st) < 0 || st.st_size != (off_t)heat->map_size;
+    if ((fresh && (ftruncate(heat->fd, 0) < 0 || ftruncate(heat->fd, heat->map_size) < 0)) ||
+        (map = mmap(NULL, heat->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    heat->fd, 0)) == MAP_FAILED) {
+        ret = -errno;
+        close(heat->fd);
+        free(heat);
+        return ret;
+    }
+
+    heat->hdr  = (struct heat_header *)map;
+    heat->ents = (struct heat_ent *)(heat->hdr + 1);
+    if (fresh || !heat_compatible(disk, heat->hdr)) {
+        memset(map, 0, heat->map_size);
+        heat->hdr->magic       = HEAT_MAGIC;
+        heat->hdr->version     = HEAT_VERSION;
+        heat->hdr->iounit_size = disk->iounit_size;
+        heat->hdr->ent_size    = sizeof(struct heat_ent);
+        heat->hdr->layout_size = disk->layout_size;
+        heat->hdr->nblks       = nblks;
+    }
+    disk->heat = heat;
+    user_info("heatmap %s, epoch %u", path, heat->hdr->epoch);
+    return 0;
+}
+
+void heat_teardown(struct ddriver *disk) {
+    struct heat_ctx *heat = disk->heat;
+    if (heat == NULL)
+        return;
+    msync(heat->hdr, heat->map_size, MS_SYNC);
+    munmap(heat->hdr, heat->map_size);
+    close(heat->fd);
+    free(heat);
+    disk->heat = NULL;
+}
+/**
+ * @brief 清零热度，设备重置时调用
+ */
+void heat_reset(struct ddriver *disk) {
+    struct heat_ctx *heat = disk->heat;
+    if (heat == NULL)
+        return;
+    memset(heat->ents, 0, heat->hdr->nblks * sizeof(struct heat_ent));
+    ATOMIC_STORE(heat->hdr->epoch, 0);
+}
+/**
+ * @brief 记录一次设备请求覆盖的IO单位。每个请求占一个epoch，
+ * 并发请求之间last_epoch可能晚到的覆盖早到的，只用来看冷热，不要求严格单调
+ *
+ * @param op DDRIVER_OP_READ / DDRIVER_OP_WRITE
+ * @param offset
+ * @param size
+ */
+void heat_record(struct ddriver *disk, int op, off_t offset, size_t size) {
+    struct heat_ctx *heat = disk->heat;
+    struct heat_ent *ent, *end;
+    uint32_t epoch;
+
+    if (heat == NULL)
+        return;
+    epoch = ATOMIC_ADD(heat->hdr->epoch, 1) + 1;
+    ent = &heat->ents[offset / disk->iounit_size];
+    end = ent + size / disk->iounit_size;
+    for (; ent < end; ent++) {
+        if (op == DDRIVER_OP_READ)
+            ATOMIC_ADD(ent->read_cnt, 1);
+        else
+            ATOMIC_ADD(ent->write_cnt, 1);
+        ATOMIC_STORE(ent->last_epoch, epoch);
+    }
+}
+/**
+ * @brief 填充IOC_REQ_DEVICE_HEATMAP，从hm->lba起最多hm->count项
+ *
+ * @param hm 出参count为实际填充个数，epoch为当前请求序号
+ * @return int 未开启热度统计返回-ENODATA
+ */
+int heat_fill(struct ddriver *disk, struct ddriver_heatmap *hm) {
+    struct heat_ctx *heat = disk->heat;
+    long long i, n;
+
+    if (heat == NULL)
+        return -ENODATA;
+    if (hm == NULL || hm->lba < 0 || hm->lba >= (long long)heat->hdr->nblks ||
+        hm->count < 0 || (hm->count > 0 && hm->ents == NULL))
+        return -EINVAL;
+    n = (long long)heat->hdr->nblks - hm->lba;
+    if (n > hm->count)
+        n = hm->count;
+    for (i = 0; i < n; i++) {
+        struct heat_ent *ent = &heat->ents[hm->lba + i];
+        hm->ents[i].read_cnt   = ATOMIC_LOAD(ent->read_cnt);
+        hm->ents[i].write_cnt  = ATOMIC_LOAD(ent->write_cnt);
+        hm->ents[i].last_epoch = ATOMIC_LOAD(ent->last_epoch);
+    }
+    hm->count = (int)n;
+    hm->epoch = ATOMIC_LOAD(heat->hdr->epoch);
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef _DDRIVER_HEAT_H_
+#define _DDRIVER_HEAT_H_
+
+#include <stdint.h>
+/******************************************************************************
+* SECTION: Heatmap file format, shared by ddriver_heat.c and tools/ddriver_heatmap.c
+*******************************************************************************/
+#define HEAT_MAGIC          0x54484444                  /* "DDHT", <image>_heat */
+#define HEAT_VERSION        1
+#define HEAT_SPARSE_MAGIC   0x43484444                  /* "DDHC", ddriver_heatmap -b */
+
+struct heat_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t iounit_size;
+    uint32_t ent_size;
+    uint64_t layout_size;
+    uint64_t nblks;                                   /* Entries, one per IO unit */
+    uint32_t epoch;                                   /* Device requests ever recorded */
+    uint32_t reserved;
+};
+
+struct heat_ent
+{
+    uint32_t read_cnt;
+    uint32_t write_cnt;
+    uint32_t last_epoch;                              /* Request that touched it last, 0: never */
+};
+
+struct heat_sparse_header                            /* Followed by count heat_sparse_rec */
+{
+    uint32_t magic;
+    uint32_t block_size;                              /* Of the records below */
+    uint64_t nblks;
+    uint64_t count;                                   /* Touched blocks only */
+    uint32_t epoch;
+    uint32_t reserved;
+};
+
+struct heat_sparse_rec
+{
+    uint64_t blk;
+    uint32_t read_cnt;
+    uint32_t write_cnt;
+    uint32_t last_epoch;
+    uint32_t reserved;
+};
+
+#endif /* _DDRIVER_HEAT_H_ */
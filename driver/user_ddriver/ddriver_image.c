@@ -0,0 +1,346 @@
+#define _GNU_SOURCE                                     /* fallocate */
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "string.h"
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "ddriver_internal.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define IMAGE_MAGIC         0x43514444                  /* "DDQC" */
+#define IMAGE_VERSION       1
+#define CLUSTER_BITS        16                          /* 64KiB, >= CONFIG_MAX_BLOCK_SZ */
+#define CLUSTER_SZ          (1LL << CLUSTER_BITS)
+#define L2_BITS             (CLUSTER_BITS - 3)          /* One cluster of 8 byte entries */
+#define L2_ENTRIES          (1LL << L2_BITS)
+#define CLUSTER_UP(x)       (((x) + CLUSTER_SZ - 1) & ~(CLUSTER_SZ - 1))
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+/**
+ * 稀疏镜像，仿qcow2的两级映射：
+ * [头 | L1表 | 原子写重做区 | 按写入顺序追加的L2表与数据簇]
+ * L1项为L2表的文件偏移，L2项为数据簇的文件偏移，0表示未分配，读出全0
+ */
+struct image_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t cluster_bits;
+    uint32_t reserved;
+    uint64_t layout_size;                             /* Device size */
+    uint64_t l1_offset;
+    uint64_t l1_entries;
+    uint64_t redo_offset;                             /* See ddriver_redo.c */
+    uint64_t data_offset;                             /* First allocatable cluster */
+};
+
+struct image_ctx
+{
+    struct image_header hdr;
+    uint64_t           *l1;                           /* L2 table file offsets */
+    uint64_t          **l2;                           /* Loaded L2 tables, NULL: unallocated */
+    off_t               end;                          /* Next cluster to allocate */
+    pthread_mutex_t     lock;                         /* Allocation */
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static int image_pwrite_all(int fd, const void *buf, size_t len, off_t offset) {
+    return pwrite(fd, buf, len, offset) == (ssize_t)len ? 0 : (errno ? -errno : -EIO);
+}
+
+static void image_free_tables(struct image_ctx *image) {
+    uint64_t i;
+    if (image->l2 != NULL)
+        for (i = 0; i < image->hdr.l1_entries; i++)
+            free(image->l2[i]);
+    free(image->l2);
+    free(image->l1);
+    image->l1 = NULL;
+    image->l2 = NULL;
+}
+/**
+ * @brief 读入L1表与所有已分配的L2表，追加位置接在文件末尾之后
+ */
+static int image_load(struct ddriver *disk, struct image_ctx *image) {
+    struct image_header *hdr = &image->hdr;
+    size_t l1_len = hdr->l1_entries * sizeof(uint64_t);
+    struct stat st;
+    uint64_t i;
+
+    image->l1 = (uint64_t *)malloc(l1_len);
+    image->l2 = (uint64_t **)calloc(hdr->l1_entries, sizeof(uint64_t *));
+    if (image->l1 == NULL || image->l2 == NULL)
+        return -ENOMEM;
+    if (pread(disk->ddriver_fd, image->l1, l1_len, hdr->l1_offset) != (ssize_t)l1_len)
+        return -EIO;
+    for (i = 0; i < hdr->l1_entries; i++) {
+        if (image->l1[i] == 0)
+            continue;
+        if ((image->l2[i] = (uint64_t *)malloc(CLUSTER_SZ)) == NULL)
+            return -ENOMEM;
+        if (pread(disk->ddriver_fd, image->l2[i], CLUSTER_SZ, image->l1[i]) != CLUSTER_SZ)
+            return -EIO;
+    }
+    if (fstat(disk->ddriver_fd, &st) < 0)
+        return -errno;
+    image->end = CLUSTER_UP(st.st_size);
+    if (image->end < (off_t)hdr->data_offset)
+        image->end = hdr->data_offset;
+    return 0;
+}
+/**
+ * @brief 新建空的稀疏镜像：只写头，L1表与重做区都是空洞
+ */
+static int image_create(struct ddriver *disk, struct image_ctx *image) {
+    struct image_header *hdr = &image->hdr;
+    uint64_t clusters = CLUSTER_UP(disk->layout_size) >> CLUSTER_BITS;
+    off_t redo_len = CLUSTER_UP((off_t)(DDRIVER_ATOMIC_MAX + 1) * CONFIG_MAX_BLOCK_SZ);
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic        = IMAGE_MAGIC;
+    hdr->version      = IMAGE_VERSION;
+    hdr->cluster_bits = CLUSTER_BITS;
+    hdr->layout_size  = disk->layout_size;
+    hdr->l1_entries   = (clusters + L2_ENTRIES - 1) >> L2_BITS;
+    hdr->l1_offset    = CLUSTER_SZ;
+    hdr->redo_offset  = hdr->l1_offset + CLUSTER_UP(hdr->l1_entries * sizeof(uint64_t));
+    hdr->data_offset  = hdr->redo_offset + redo_len;
+    if (ftruncate(disk->ddriver_fd, hdr->data_offset) < 0)
+        return -errno;
+    return image_pwrite_all(disk->ddriver_fd, hdr, sizeof(*hdr), 0);
+}
+/**
+ * @brief 在文件末尾追加一个全0的簇，需持image->lock
+ */
+static off_t image_alloc(struct ddriver *disk, struct image_ctx *image) {
+    off_t off = image->end;
+    if (ftruncate(disk->ddriver_fd, off + CLUSTER_SZ) < 0)
+        return -errno;
+    image->end += CLUSTER_SZ;
+    return off;
+}
+/**
+ * @brief 设备簇号到文件偏移。alloc为0时未分配返回0；
+ * 否则按需分配L2表与数据簇，先落盘映射项再发布，并发的分配由image->lock串行
+ */
+static off_t image_map(struct ddriver *disk, uint64_t cluster, int alloc) {
+    struct image_ctx *image = disk->image;
+    uint64_t i = cluster >> L2_BITS, j = cluster & (L2_ENTRIES - 1);
+    uint64_t *l2 = __atomic_load_n(&image->l2[i], __ATOMIC_ACQUIRE);
+    off_t off;
+    int ret = 0;
+
+    if (l2 != NULL && (off = ATOMIC_LOAD(l2[j])) != 0)
+        return off;
+    if (!alloc)
+        return 0;
+
+    pthread_mutex_lock(&image->lock);
+    if ((l2 = image->l2[i]) == NULL) {
+        if ((l2 = (uint64_t *)calloc(1, CLUSTER_SZ)) == NULL) {
+            off = -ENOMEM;
+            goto out;
+        }
+        if ((off = image_alloc(disk, image)) < 0 ||
+            (ret = image_pwrite_all(disk->ddriver_fd, &off, sizeof(off),
+                                    image->hdr.l1_offset + i * sizeof(uint64_t))) < 0) {
+            free(l2);
+            off = off < 0 ? off : ret;
+            goto out;
+        }
+        image->l1[i] = off;
+        __atomic_store_n(&image->l2[i], l2, __ATOMIC_RELEASE);
+    }
+    if ((off = l2[j]) == 0) {
+        if ((off = image_alloc(disk, image)) < 0)
+            goto out;
+        if ((ret = image_pwrite_all(disk->ddriver_fd, &off, sizeof(off),
+                                    image->l1[i] + j * sizeof(uint64_t))) < 0) {
+            off = ret;
+            goto out;
+        }
+        ATOMIC_STORE(l2[j], off);
+    }
+out:
+    pthread_mutex_unlock(&image->lock);
+    return off;
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 打开设备时调用，在任何IO之前。以DDQC开头的镜像按稀疏格式打开，
+ * 设备大小以镜像头为准；sparse非0且镜像为空时新建稀疏镜像；
+ * 其余按原始格式预分配整个设备
+ *
+ * @param sparse DDRIVER_OPT_SPARSE
+ * @return int
+ */
+int image_setup(struct ddriver *disk, int sparse) {
+    struct image_ctx *image;
+    struct stat st;
+    int ret;
+
+    disk->redo_offset = disk->layout_size;
+    if (fstat(disk->ddriver_fd, &st) < 0)
+        return -errno;
+    if ((image = (struct image_ctx *)calloc(1, sizeof(struct image_ctx))) == NULL)
+        return -ENOMEM;
+    if (st.st_size < (off_t)sizeof(struct image_header) ||
+        pread(disk->ddriver_fd, &image->hdr, sizeof(image->hdr), 0) != sizeof(image->hdr) ||
+        image->hdr.magic != IMAGE_MAGIC) {
+        if (!sparse || st.st_size != 0) {
+            free(image);
+            if (sparse)
+                user_alert("%s is a raw image, open it as raw", disk->path);
+            if ((ret = redo_check_raw(disk, st.st_size)) < 0)
+                return ret;
+            ret = posix_fallocate(disk->ddriver_fd, 0, disk->layout_size);
+            return -ret;
+        }
+        if ((ret = image_create(disk, image)) < 0) {
+            free(image);
+            return ret;
+        }
+    }
+    else if (image->hdr.version != IMAGE_VERSION || image->hdr.cluster_bits != CLUSTER_BITS ||
+             image->hdr.layout_size % disk->iounit_size != 0) {
+        user_alert("unsupported sparse image or io unit %d", disk->iounit_size);
+        free(image);
+        return -EINVAL;
+    }
+
+    pthread_mutex_init(&image->lock, NULL);
+    disk->image = image;
+    if ((ret = image_load(disk, image)) < 0)
+        return ret;                                   /* Freed with the device */
+    disk->layout_size = image->hdr.layout_size;
+    disk->redo_offset = image->hdr.redo_offset;
+    user_info("sparse image, %lld bytes, %lld allocated", (long long)disk->layout_size,
+              (long long)(image->end - image->hdr.data_offset));
+    return 0;
+}
+
+void image_teardown(struct ddriver *disk) {
+    struct image_ctx *image = disk->image;
+    if (image == NULL)
+        return;
+    image_free_tables(image);
+    pthread_mutex_destroy(&image->lock);
+    free(image);
+    disk->image = NULL;
+}
+/**
+ * @brief 镜像文件被整体替换(快照回滚)后重新读入映射表，需持io_lock写锁
+ */
+int image_reload(struct ddriver *disk) {
+    struct image_ctx *image = disk->image;
+    if (image == NULL)
+        return 0;
+    image_free_tables(image);
+    return image_load(disk, image);
+}
+/**
+ * @brief 读设备[offset, offset + size)，稀疏镜像下未分配的簇不访问文件，直接填0
+ *
+ * @return ssize_t 读出字节数，负数为-errno
+ */
+ssize_t image_read(struct ddriver *disk, char *buf, size_t size, off_t offset) {
+    size_t done, len;
+    ssize_t ret;
+    off_t host;
+
+    if (disk->image == NULL) {
+        ret = pread(disk->ddriver_fd, buf, size, offset);
+        return ret < 0 ? -errno : ret;
+    }
+    for (done = 0; done < size; done += len) {
+        off_t in = (offset + done) & (CLUSTER_SZ - 1);
+        len  = size - done < (size_t)(CLUSTER_SZ - in) ? size - done : (size_t)(CLUSTER_SZ - in);
+        host = image_map(disk, (offset + done) >> CLUSTER_BITS, 0);
+        if (host == 0)
+            memset(buf + done, 0, len);
+        else if (pread(disk->ddriver_fd, buf + done, len, host + in) < 0)
+            return -errno;
+    }
+    return size;
+}
+/**
+ * @brief 写设备[offset, offset + size)，稀疏镜像下按需分配簇，文件随写入增长
+ *
+ * @return ssize_t 写入字节数，负数为-errno
+ */
+ssize_t image_write(struct ddriver *disk, const char *buf, size_t size, off_t offset) {
+    size_t done, len;
+    ssize_t ret;
+    off_t host;
+
+    if (disk->image == NULL) {
+        ret = pwrite(disk->ddriver_fd, buf, size, offset);
+        return ret < 0 ? -errno : ret;
+    }
+    for (done = 0; done < size; done += len) {
+        off_t in = (offset + done) & (CLUSTER_SZ - 1);
+        len  = size - done < (size_t)(CLUSTER_SZ - in) ? size - done : (size_t)(CLUSTER_SZ - in);
+        if ((host = image_map(disk, (offset + done) >> CLUSTER_BITS, 1)) < 0)
+            return host;
+        if (pwrite(disk->ddriver_fd, buf + done, len, host + in) < 0)
+            return -errno;
+    }
+    return size;
+}
+/**
+ * @brief 聚集写，原始镜像一次pwritev，稀疏镜像逐段映射
+ */
+ssize_t image_writev(struct ddriver *disk, const struct iovec *iov, int cnt, off_t offset) {
+    ssize_t ret, done = 0;
+    int i;
+
+    if (disk->image == NULL) {
+        ret = pwritev(disk->ddriver_fd, iov, cnt, offset);
+        return ret < 0 ? -errno : ret;
+    }
+    for (i = 0; i < cnt; i++) {
+        if ((ret = image_write(disk, iov[i].iov_base, iov[i].iov_len, offset + done)) < 0)
+            return ret;
+        done += ret;
+    }
+    return done;
+}
+/**
+ * @brief 稀疏镜像的丢弃：对已分配的簇在文件中打洞，映射保留，读出全0。
+ * 宿主文件系统不支持打洞时写0
+ *
+ * @return int
+ */
+int image_discard(struct ddriver *disk, off_t offset, off_t len) {
+    static char zero[CONFIG_MAX_BLOCK_SZ];
+    off_t done, chunk, host, part, n;
+
+    for (done = 0; done < len; done += chunk) {
+        off_t in = (offset + done) & (CLUSTER_SZ - 1);
+        chunk = len - done < CLUSTER_SZ - in ? len - done : CLUSTER_SZ - in;
+        host  = image_map(disk, (offset + done) >> CLUSTER_BITS, 0);
+        if (host < 0)
+            return (int)host;
+        if (host == 0 || fallocate(disk->ddriver_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                   host + in, chunk) == 0)
+            continue;
+        if (errno != EOPNOTSUPP && errno != ENOSYS)
+            return -errno;
+        for (part = 0; part < chunk; part += n) {
+            n = chunk - part < (off_t)sizeof(zero) ? chunk - part : (off_t)sizeof(zero);
+            errno = 0;
+            if (pwrite(disk->ddriver_fd, zero, n, host + in + part) != n)
+                return errno != 0 ? -errno : -EIO;
+        }
+    }
+    return 0;
+}
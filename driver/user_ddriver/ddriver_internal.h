@@ -0,0 +1,262 @@
+#ifndef _DDRIVER_INTERNAL_H_
+#define _DDRIVER_INTERNAL_H_
+
+#include "stdio.h"
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include "ddriver_ctl.h"
+#include "include/ddriver.h"
+#include "ddriver_trace.h"
+#include "ddriver_heat.h"
+
+#define USER_INFO     "INFO: "
+#define USER_ALERT    "WARNING: "
+
+#define USER_PANIC    "PANIC: "
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/   
+#define DEVICE_NAME   "ddriver"
+#define DEVICE_LOG    "_log"                            /* Appended to the image path */
+#define DEVICE_SNAP   "_snap"                           /* Reflink snapshot, next to the image */
+#define DEVICE_HEAT   "_heat"                           /* Per IO unit access counts */
+#define ENV_MMAP      "DDRIVER_MMAP"
+#define ENV_DISK_SZ   "DDRIVER_DISK_SZ"
+#define ENV_IO_SZ     "DDRIVER_IO_SZ"
+#define ENV_QD        "DDRIVER_QD"
+#define ENV_CACHE     "DDRIVER_CACHE"
+#define ENV_MODEL     "DDRIVER_MODEL"
+#define ENV_SLEEP     "DDRIVER_MODEL_SLEEP"
+#define ENV_BW        "DDRIVER_BW"
+#define ENV_TRACE     "DDRIVER_TRACE"
+#define ENV_TRACE_SZ  "DDRIVER_TRACE_SZ"
+#define ENV_LOG       "DDRIVER_LOG"
+#define ENV_HEATMAP   "DDRIVER_HEATMAP"
+#define ENV_SPARSE    "DDRIVER_SPARSE"
+#define ENV_ELIDE     "DDRIVER_ELIDE"
+
+#define user_info(fmt, ...)\
+	do {\
+		if (LOG_ENABLED(disk, DDRIVER_LOG_INFO))\
+			log_write(disk, DDRIVER_LOG_INFO, fmt, ##__VA_ARGS__);\
+	} while(0)\
+
+#define user_alert(fmt, ...)\
+	do {\
+		static struct log_ratelimit __rl;\
+		if (LOG_ENABLED(disk, DDRIVER_LOG_ALERT) && log_ratelimit(disk, &__rl))\
+			log_write(disk, DDRIVER_LOG_ALERT, fmt, ##__VA_ARGS__);\
+	} while(0)\
+
+#define user_panic(fmt, ...)\
+    do {\
+        printf(USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
+    } while (0)\
+
+#define DRIVER_AUTHOR   "Deadpool <deadpoolmine@qq.com>"
+#define DRIVER_DESC     "A Fake disk driver in user space"
+#define DRIVER_VERSION  "0.1.0"
+
+#define CONFIG_DISK_SZ  (4 * 1024 * 1024)               /* Default, see ddriver_options */
+#define CONFIG_BLOCK_SZ (512)                           /* Default, see ddriver_options */
+#define CONFIG_MAX_BLOCK_SZ (64 * 1024)
+#define CONFIG_QUEUE_DEPTH  (64)                        /* Default async queue depth */
+#define CONFIG_TRACE_SZ     (16 * 1024 * 1024)          /* Default trace ring file size */
+#define CONFIG_MAX_FDS      (1024)                      /* Handles are image fds below this */
+#ifndef CONFIG_LOG_LEVEL
+#define CONFIG_LOG_LEVEL    DDRIVER_LOG_INFO            /* Levels above are compiled out */
+#endif
+#define CONFIG_LOG_SLOTS    (256)                       /* Log ring entries, power of 2 */
+#define CONFIG_LOG_MSG      (160)                       /* Longer messages are truncated */
+#define CONFIG_LOG_BURST    (10)                        /* Alerts per call site per window */
+#define CONFIG_LOG_WINDOW_NS (1000000000ULL)
+#define CONFIG_SCHED_MERGE_SZ (1024 * 1024)             /* Largest merged batch IO */
+/******************************************************************************
+* SECTION: Macro Functions 
+*******************************************************************************/
+#define IGNORE_ARG(arg)         ((void)arg)
+#define IS_ADDR_ALIGN(addr)     (addr % disk->iounit_size == 0)
+#define ADDR_ROUND_UP(addr)     ((addr / disk->iounit_size) * disk->iounit_size)
+#define IS_MAPPED(disk)         ((disk)->map != NULL)
+
+#define ATOMIC_ADD(var, val)    __atomic_fetch_add(&(var), val, __ATOMIC_RELAXED)
+#define ATOMIC_LOAD(var)        __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define ATOMIC_STORE(var, val)  __atomic_store_n(&(var), val, __ATOMIC_RELAXED)
+#define ATOMIC_CAS(var, old, val) \
+    __atomic_compare_exchange_n(&(var), &(old), val, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+
+#define INC_READCNT(disk)       ATOMIC_ADD((disk)->read_cnt, 1)
+#define INC_WRITECNT(disk)      ATOMIC_ADD((disk)->write_cnt, 1)
+#define INC_SEEKCNT(disk)       ATOMIC_ADD((disk)->seek_cnt, 1)
+
+#define IO_BEGIN(disk)          pthread_rwlock_rdlock(&(disk)->io_lock)
+#define IO_END(disk)            pthread_rwlock_unlock(&(disk)->io_lock)
+
+#define LOG_ENABLED(disk, level) ((level) <= CONFIG_LOG_LEVEL && (level) <= (disk)->log_level)
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+struct aio_ctx;                                      /* ddriver_aio.c */
+struct wb_cache;                                     /* ddriver_cache.c */
+struct model_ctx;                                    /* ddriver_model.c */
+struct trace_ctx;                                    /* ddriver_trace.c */
+struct snap_ctx;                                     /* ddriver_snap.c */
+struct log_ctx;                                      /* ddriver_log.c */
+struct heat_ctx;                                     /* ddriver_heat.c */
+struct image_ctx;                                    /* ddriver_image.c */
+struct elide_ctx;                                    /* ddriver_elide.c */
+
+struct log_ratelimit                                 /* Per user_alert call site */
+{
+    unsigned long long begin;                        /* Window start */
+    int  printed;
+    int  missed;
+};
+
+struct ddriver
+{
+    int  ddriver_fd;                                 /* Disk ddriver_fd, also the handle */
+    char *path;                                      /* Image path */
+    struct log_ctx *log;                             /* NULL: print synchronously */
+    int  log_level;                                  /* DDRIVER_LOG_*, runtime filter */
+    off_t head;                                      /* Implied head position */
+    off_t cursor;                                    /* Offset of ddriver_read/write, set by seek */
+    pthread_rwlock_t io_lock;                        /* Shared by IO, exclusive for reset */
+    char *map;                                       /* MAP_SHARED image, NULL if not mmap mode */
+    unsigned long long read_cnt;                     /* In IO units */
+    unsigned long long write_cnt;
+    unsigned long long seek_cnt;
+    unsigned long long read_bytes;
+    unsigned long long write_bytes;
+    unsigned long long lat_hist[DDRIVER_LAT_OPS][DDRIVER_HIST_BUCKETS];
+    unsigned long long seek_hist[DDRIVER_HIST_BUCKETS];
+    unsigned long long cache_read_hits;              /* In IO units */
+    unsigned long long cache_write_hits;
+    unsigned long long cache_flush_runs;
+    unsigned long long model_ns;                     /* Modeled device busy time */
+    unsigned long long model_throttle_ns;
+    struct ddriver_tag_stat tags[DDRIVER_TAGS];      /* By the submitting thread's tag */
+    unsigned long long sched_batches;                /* ddriver_submit_batch calls */
+    unsigned long long sched_merges;                 /* Requests merged into a neighbour */
+    unsigned long long sched_seeks_saved;
+    unsigned long long write_elided;                 /* In IO units */
+    int  major_num;
+    int  open_count;
+    off_t layout_size;
+    int  iounit_size;
+    int  queue_depth;                                /* Async submission queue depth */
+    struct aio_ctx   *aio;                           /* Backend set up at the first submit */
+    struct wb_cache  *cache;                         /* NULL: no write-back cache */
+    struct model_ctx *model;                         /* NULL: no device model */
+    struct trace_ctx *trace;                         /* NULL: no tracing */
+    struct snap_ctx  *snap;                          /* NULL: no snapshot taken */
+    struct heat_ctx  *heat;                          /* NULL: no heatmap */
+    unsigned long long redo_seq;                     /* Last atomic write, under io_lock */
+    off_t redo_offset;                               /* Redo record in the image file */
+    struct image_ctx *image;                         /* NULL: raw image */
+    struct elide_ctx *elide;                         /* NULL: no write elision */
+};
+/******************************************************************************
+* SECTION: ddriver.c
+*******************************************************************************/
+struct ddriver *dev_get(int fd);
+int check_range(struct ddriver *disk, off_t lba, int blks);
+int check_pio(struct ddriver *disk, off_t offset, size_t size);
+int do_io(struct ddriver *disk, int op, char *buf, size_t size, off_t offset);
+long long parse_size(const char *str);
+/******************************************************************************
+* SECTION: ddriver_stat.c
+*******************************************************************************/
+unsigned long long stat_now(void);
+void stat_io(struct ddriver *disk, int op, off_t offset, size_t size);
+void stat_seek(struct ddriver *disk, off_t offset);
+void stat_latency(struct ddriver *disk, int lat_op, unsigned long long start_ns);
+int  stat_get_tag(void);
+int  stat_set_tag(int tag);
+void stat_tag(struct ddriver *disk, int tag, int op, size_t size, unsigned long long start_ns);
+void stat_reset(struct ddriver *disk);
+int  stat_fill_ext(struct ddriver *disk, struct ddriver_state_ext *ext);
+/******************************************************************************
+* SECTION: ddriver_cache.c
+*******************************************************************************/
+int  cache_setup(struct ddriver *disk, long long size);
+void cache_teardown(struct ddriver *disk);
+int  cache_write(struct ddriver *disk, const char *buf, size_t size, off_t offset);
+int  cache_read(struct ddriver *disk, char *buf, size_t size, off_t offset);
+void cache_barrier(struct ddriver *disk);
+int  cache_flush(struct ddriver *disk);
+void cache_discard(struct ddriver *disk, off_t offset, off_t len);
+/******************************************************************************
+* SECTION: ddriver_model.c
+*******************************************************************************/
+int  model_lookup(const char *name);
+int  model_setup(struct ddriver *disk, int kind, int sleep, long long bw_limit);
+void model_teardown(struct ddriver *disk);
+void model_reset(struct ddriver *disk);
+void model_charge(struct ddriver *disk, off_t from, off_t offset, size_t size);
+/******************************************************************************
+* SECTION: ddriver_trace.c
+*******************************************************************************/
+int  trace_setup(struct ddriver *disk, const char *path, long long size);
+void trace_teardown(struct ddriver *disk);
+void trace_record(struct ddriver *disk, int op, unsigned long long offset, unsigned int size);
+/******************************************************************************
+* SECTION: ddriver_heat.c
+*******************************************************************************/
+int  heat_setup(struct ddriver *disk, const char *path);
+void heat_teardown(struct ddriver *disk);
+void heat_reset(struct ddriver *disk);
+void heat_record(struct ddriver *disk, int op, off_t offset, size_t size);
+int  heat_fill(struct ddriver *disk, struct ddriver_heatmap *hm);
+/******************************************************************************
+* SECTION: ddriver_image.c
+*******************************************************************************/
+int     image_setup(struct ddriver *disk, int sparse);
+void    image_teardown(struct ddriver *disk);
+int     image_reload(struct ddriver *disk);
+ssize_t image_read(struct ddriver *disk, char *buf, size_t size, off_t offset);
+ssize_t image_write(struct ddriver *disk, const char *buf, size_t size, off_t offset);
+ssize_t image_writev(struct ddriver *disk, const struct iovec *iov, int cnt, off_t offset);
+int     image_discard(struct ddriver *disk, off_t offset, off_t len);
+/******************************************************************************
+* SECTION: ddriver_elide.c
+*******************************************************************************/
+int  elide_setup(struct ddriver *disk);
+void elide_teardown(struct ddriver *disk);
+unsigned long long elide_begin(struct ddriver *disk, int op);
+size_t elide_next(struct ddriver *disk, const char *buf, size_t size, off_t offset, size_t *run);
+void elide_record(struct ddriver *disk, unsigned long long gen, int op, const char *buf,
+                  size_t size, off_t offset);
+void elide_invalidate(struct ddriver *disk, off_t offset, off_t len);
+void elide_zero(struct ddriver *disk, off_t offset, off_t len);
+/******************************************************************************
+* SECTION: ddriver_redo.c
+*******************************************************************************/
+int  redo_check_raw(struct ddriver *disk, off_t file_size);
+int  redo_recover(struct ddriver *disk);
+int  redo_atomic_write(struct ddriver *disk, struct ddriver_atomic_write *aw);
+/******************************************************************************
+* SECTION: ddriver_snap.c
+*******************************************************************************/
+int  snap_take(struct ddriver *disk);
+int  snap_rollback(struct ddriver *disk);
+int  snap_preserve(struct ddriver *disk, off_t offset, off_t len);
+void snap_teardown(struct ddriver *disk);
+/******************************************************************************
+* SECTION: ddriver_log.c
+*******************************************************************************/
+int  log_lookup(const char *name);
+int  log_setup(struct ddriver *disk, const char *path);
+void log_teardown(struct ddriver *disk);
+void log_write(struct ddriver *disk, int level, const char *fmt, ...)
+     __attribute__((format(printf, 3, 4)));
+int  log_ratelimit(struct ddriver *disk, struct log_ratelimit *rl);
+/******************************************************************************
+* SECTION: ddriver_aio.c
+*******************************************************************************/
+int  aio_init(struct ddriver *disk);
+void aio_teardown(struct ddriver *disk);
+int  aio_inflight(struct ddriver *disk);
+
+#endif /* _DDRIVER_INTERNAL_H_ */
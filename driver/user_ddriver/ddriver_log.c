@@ -0,0 +1,217 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include <stdarg.h>
+#include <errno.h>
+#include <semaphore.h>
+#include "ddriver_internal.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define LOG_MASK            (CONFIG_LOG_SLOTS - 1)
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+struct log_slot
+{
+    unsigned            seq;                          /* == pos: free, == pos + 1: published */
+    int                 level;
+    char                msg[CONFIG_LOG_MSG];
+};
+
+struct log_ctx
+{
+    FILE               *file;                         /* <image path>_log */
+    unsigned            tail;                         /* Next slot to claim, producers */
+    unsigned            head;                         /* Next slot to drain, log thread only */
+    unsigned long long  dropped;                      /* Ring full, never block the caller */
+    int                 stop;
+    sem_t               ready;
+    pthread_t           thread;
+    struct log_slot     slots[CONFIG_LOG_SLOTS];
+};
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+static const char *log_names[] = {
+    [DDRIVER_LOG_NONE]  = "none",
+    [DDRIVER_LOG_ALERT] = "alert",
+    [DDRIVER_LOG_INFO]  = "info"
+};
+
+static const char *log_prefix[] = {
+    [DDRIVER_LOG_ALERT] = USER_ALERT,
+    [DDRIVER_LOG_INFO]  = USER_INFO
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static void log_emit(FILE *file, int level, const char *msg) {
+    printf("%s" DEVICE_NAME " %s\n", log_prefix[level], msg);
+    if (file != NULL)
+        fprintf(file, "%s" DEVICE_NAME " %s\n", log_prefix[level], msg);
+}
+/**
+ * @brief 后台线程：按声明顺序输出已发布的槽位，环空时刷新并睡眠
+ */
+static void *log_worker(void *arg) {
+    struct log_ctx *log = (struct log_ctx *)arg;
+    struct log_slot *slot;
+    unsigned long long dropped;
+    char note[64];
+
+    for (;;) {
+        slot = &log->slots[log->head & LOG_MASK];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == log->head + 1) {
+            log_emit(log->file, slot->level, slot->msg);
+            __atomic_store_n(&slot->seq, log->head + CONFIG_LOG_SLOTS, __ATOMIC_RELEASE);
+            log->head++;
+            continue;
+        }
+        if ((dropped = __atomic_exchange_n(&log->dropped, 0, __ATOMIC_RELAXED)) != 0) {
+            snprintf(note, sizeof(note), "%llu log messages dropped", dropped);
+            log_emit(log->file, DDRIVER_LOG_ALERT, note);
+        }
+        fflush(stdout);
+        if (log->file != NULL)
+            fflush(log->file);
+        if (__atomic_load_n(&log->stop, __ATOMIC_ACQUIRE))
+            break;
+        while (sem_wait(&log->ready) < 0 && errno == EINTR)
+            ;
+    }
+    return NULL;
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 按名字查找日志级别
+ *
+ * @param name "none" / "alert" / "info"
+ * @return int DDRIVER_LOG_开头，未知返回DDRIVER_LOG_DEFAULT
+ */
+int log_lookup(const char *name) {
+    int i;
+    for (i = DDRIVER_LOG_NONE; i <= DDRIVER_LOG_INFO; i++) {
+        if (strcmp(log_names[i], name) == 0)
+            return i;
+    }
+    return DDRIVER_LOG_DEFAULT;
+}
+/**
+ * @brief 打开设备时调用，打开日志文件并启动输出线程
+ *
+ * @param path 日志文件路径
+ * @return int
+ */
+int log_setup(struct ddriver *disk, const char *path) {
+    struct log_ctx *log = (struct log_ctx *)calloc(1, sizeof(struct log_ctx));
+    unsigned i;
+
+    if (log == NULL)
+        return -ENOMEM;
+    if ((log->file = fopen(path, "w+")) == NULL) {
+        free(log);
+        return -errno;
+    }
+    for (i = 0; i < CONFIG_LOG_SLOTS; i++)
+        log->slots[i].seq = i;
+    sem_init(&log->ready, 0, 0);
+    if (pthread_create(&log->thread, NULL, log_worker, log) != 0) {
+        sem_destroy(&log->ready);
+        fclose(log->file);
+        free(log);
+        return -EAGAIN;
+    }
+    disk->log = log;
+    return 0;
+}
+/**
+ * @brief 关闭设备时最后调用，输出剩余日志后关闭文件
+ */
+void log_teardown(struct ddriver *disk) {
+    struct log_ctx *log = disk->log;
+
+    if (log == NULL)
+        return;
+    __atomic_store_n(&log->stop, 1, __ATOMIC_RELEASE);
+    sem_post(&log->ready);
+    pthread_join(log->thread, NULL);
+    sem_destroy(&log->ready);
+    fclose(log->file);
+    free(log);
+    disk->log = NULL;
+}
+/**
+ * @brief 格式化后放入环形缓冲区即返回，不碰stdio。多线程并发调用时各自CAS占一个槽位，
+ * 环满则丢弃并计数。日志线程未启动(打开设备之前)时直接输出
+ *
+ * @param level DDRIVER_LOG_ALERT / DDRIVER_LOG_INFO
+ * @param fmt
+ */
+void log_write(struct ddriver *disk, int level, const char *fmt, ...) {
+    struct log_ctx *log = disk->log;
+    struct log_slot *slot;
+    unsigned pos;
+    va_list ap;
+    int diff;
+
+    va_start(ap, fmt);
+    if (log == NULL) {
+        char msg[CONFIG_LOG_MSG];
+        vsnprintf(msg, sizeof(msg), fmt, ap);
+        va_end(ap);
+        log_emit(NULL, level, msg);
+        return;
+    }
+
+    pos = __atomic_load_n(&log->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = &log->slots[pos & LOG_MASK];
+        diff = (int)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&log->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0) {
+            va_end(ap);
+            ATOMIC_ADD(log->dropped, 1);
+            return;
+        }
+        else {
+            pos = __atomic_load_n(&log->tail, __ATOMIC_RELAXED);
+        }
+    }
+    vsnprintf(slot->msg, sizeof(slot->msg), fmt, ap);
+    va_end(ap);
+    slot->level = level;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    sem_post(&log->ready);
+}
+/**
+ * @brief 告警限速：每个调用点每个窗口最多CONFIG_LOG_BURST条，
+ * 下一个窗口的第一条之前补一条被抑制的数量
+ *
+ * @param rl 调用点的静态状态
+ * @return int 非0则可以输出
+ */
+int log_ratelimit(struct ddriver *disk, struct log_ratelimit *rl) {
+    unsigned long long now = stat_now();
+    unsigned long long begin = ATOMIC_LOAD(rl->begin);
+    int missed;
+
+    if (now - begin >= CONFIG_LOG_WINDOW_NS &&
+        __atomic_compare_exchange_n(&rl->begin, &begin, now, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        ATOMIC_STORE(rl->printed, 0);
+        if ((missed = __atomic_exchange_n(&rl->missed, 0, __ATOMIC_RELAXED)) != 0)
+            log_write(disk, DDRIVER_LOG_ALERT, "%d similar alerts suppressed", missed);
+    }
+    if (ATOMIC_ADD(rl->printed, 1) >= CONFIG_LOG_BURST) {
+        ATOMIC_ADD(rl->missed, 1);
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,174 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include <time.h>
+#include <errno.h>
+#include "ddriver_internal.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define NSEC_PER_SEC        (1000000000ULL)
+#define MODEL_BURST_NS      (10000000ULL)               /* Token bucket depth: 10 ms at the cap */
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+struct model_profile
+{
+    const char        *name;
+    unsigned long long req_ns;                        /* Per request overhead (command, controller) */
+    unsigned long long seek_min_ns;                   /* Track to track */
+    unsigned long long seek_max_ns;                   /* Full stroke */
+    unsigned long long rot_ns;                        /* One revolution, a random access waits half */
+    unsigned long long bandwidth;                     /* Media rate, bytes/s */
+};
+
+struct model_ctx
+{
+    const struct model_profile *profile;
+    int                 sleep;                        /* Sleep for the modeled time */
+    unsigned long long  bw_limit;                     /* Token bucket rate, bytes/s, 0: none */
+    unsigned long long  tat;                          /* Bucket theoretical arrival time */
+    pthread_mutex_t     lock;
+};
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+static const struct model_profile profiles[] = {
+    [DDRIVER_MODEL_NONE] = { "none", 0, 0, 0, 0, 0 },
+    [DDRIVER_MODEL_HDD]  = { "hdd",  50000, 500000, 15000000, 8333333, 150000000ULL },
+    [DDRIVER_MODEL_SSD]  = { "ssd",  60000, 0, 0, 0, 520000000ULL },
+    [DDRIVER_MODEL_NVME] = { "nvme", 10000, 0, 0, 0, 3000000000ULL }
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static unsigned long long isqrt(unsigned long long x) {
+    unsigned long long r = 0, bit = 1ULL << 62;
+    while (bit > x)
+        bit >>= 2;
+    while (bit != 0) {
+        if (x >= r + bit) {
+            x -= r + bit;
+            r  = (r >> 1) + bit;
+        }
+        else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return r;
+}
+/**
+ * @brief 寻道时间随距离按平方根增长：seek_min + (seek_max - seek_min) * sqrt(dis / disk)
+ */
+static unsigned long long seek_cost(struct ddriver *disk, const struct model_profile *p,
+                                    off_t dis) {
+    unsigned long long frac;                          /* sqrt(dis / disk) in 1/1024 */
+    if (p->seek_max_ns == 0)
+        return 0;
+    frac = isqrt(((unsigned long long)dis << 20) / disk->layout_size);
+    return p->seek_min_ns + (p->seek_max_ns - p->seek_min_ns) * frac / 1024 + p->rot_ns / 2;
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 按名字查找设备模型
+ *
+ * @param name "none" / "hdd" / "ssd" / "nvme"
+ * @return int DDRIVER_MODEL_开头，未知返回-EINVAL
+ */
+int model_lookup(const char *name) {
+    int i;
+    for (i = 0; i < (int)(sizeof(profiles) / sizeof(profiles[0])); i++) {
+        if (strcmp(profiles[i].name, name) == 0)
+            return i;
+    }
+    return -EINVAL;
+}
+/**
+ * @brief 打开设备时调用，不模拟且不限速时不分配上下文
+ *
+ * @param kind DDRIVER_MODEL_开头
+ * @param sleep 非0则按模型时间真实睡眠，否则只推进虚拟时钟
+ * @param bw_limit 令牌桶带宽上限，字节/秒，0表示不限
+ * @return int
+ */
+int model_setup(struct ddriver *disk, int kind, int sleep, long long bw_limit) {
+    struct model_ctx *model;
+
+    if (kind < 0 || kind >= (int)(sizeof(profiles) / sizeof(profiles[0])) || bw_limit < 0)
+        return -EINVAL;
+    if (kind == DDRIVER_MODEL_NONE && bw_limit == 0)
+        return 0;
+    if ((model = (struct model_ctx *)malloc(sizeof(struct model_ctx))) == NULL)
+        return -ENOMEM;
+    model->profile  = &profiles[kind];
+    model->sleep    = sleep;
+    model->bw_limit = bw_limit;
+    model->tat      = 0;
+    pthread_mutex_init(&model->lock, NULL);
+    disk->model = model;
+    user_info("device model %s%s, bandwidth cap %lld B/s", model->profile->name,
+              sleep ? " (sleep)" : "", bw_limit);
+    return 0;
+}
+
+void model_teardown(struct ddriver *disk) {
+    if (disk->model == NULL)
+        return;
+    pthread_mutex_destroy(&disk->model->lock);
+    free(disk->model);
+    disk->model = NULL;
+}
+
+void model_reset(struct ddriver *disk) {
+    if (disk->model == NULL)
+        return;
+    pthread_mutex_lock(&disk->model->lock);
+    disk->model->tat = 0;
+    pthread_mutex_unlock(&disk->model->lock);
+}
+/**
+ * @brief 为一次设备请求计时：请求开销 + 非顺序时的寻道与旋转等待 + 传输，
+ * 再经令牌桶限速。虚拟时钟即累计的设备忙时间，sleep模式下同时真实睡眠
+ *
+ * @param from 请求前的磁头位置
+ * @param offset
+ * @param size
+ */
+void model_charge(struct ddriver *disk, off_t from, off_t offset, size_t size) {
+    struct model_ctx *model = disk->model;
+    const struct model_profile *p;
+    unsigned long long cost, now, wait = 0;
+    struct timespec ts;
+
+    if (model == NULL)
+        return;
+    p = model->profile;
+    cost = p->req_ns;
+    if (from != offset)
+        cost += seek_cost(disk, p, offset > from ? offset - from : from - offset);
+    if (p->bandwidth != 0)
+        cost += size * NSEC_PER_SEC / p->bandwidth;
+
+    if (model->bw_limit != 0) {                       /* GCRA form of the token bucket */
+        pthread_mutex_lock(&model->lock);
+        now = model->sleep ? stat_now() : ATOMIC_LOAD(disk->model_ns) + cost;
+        if (model->tat < now)
+            model->tat = now;
+        model->tat += size * NSEC_PER_SEC / model->bw_limit;
+        if (model->tat > now + MODEL_BURST_NS)
+            wait = model->tat - now - MODEL_BURST_NS;
+        pthread_mutex_unlock(&model->lock);
+        ATOMIC_ADD(disk->model_throttle_ns, wait);
+    }
+
+    ATOMIC_ADD(disk->model_ns, cost + wait);
+    if (model->sleep) {
+        ts.tv_sec  = (cost + wait) / NSEC_PER_SEC;
+        ts.tv_nsec = (cost + wait) % NSEC_PER_SEC;
+        while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+            ;
+    }
+}
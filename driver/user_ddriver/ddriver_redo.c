@@ -0,0 +1,237 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include <errno.h>
+#include "string.h"
+#include <stdint.h>
+#include <sys/mman.h>
+#include "ddriver_internal.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define REDO_MAGIC          0x4f444552                  /* "REDO" */
+#define REDO_VERSION        2
+#define FNV_OFFSET          0xcbf29ce484222325ULL
+#define FNV_PRIME           0x100000001b3ULL
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+/**
+ * 重做记录位于镜像文件中设备末尾之后(稀疏镜像为头部预留的重做区)，不占设备容量：
+ * 一个IO单位的头，后跟count个IO单位的数据。校验和覆盖头与数据，
+ * 写了一半的记录校验不过，视为没有提交。原始镜像的记录位置取决于设备大小，
+ * 因此头中记下设备大小，清掉记录时截回设备末尾
+ */
+struct redo_header
+{
+    uint32_t magic;                                   /* 0: no pending record */
+    uint32_t version;
+    uint32_t iounit_size;
+    uint32_t count;
+    uint64_t seq;
+    uint64_t layout_size;                             /* v2: 写下记录时的设备大小 */
+    uint64_t csum;                                    /* FNV-1a, computed with csum = 0 */
+    uint64_t lbas[DDRIVER_ATOMIC_MAX];
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static uint64_t redo_csum(const char *rec, size_t len) {
+    uint64_t hash = FNV_OFFSET;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char)rec[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+/**
+ * @brief 将记录中的每个IO单位写到原位并落盘。重复执行结果相同，
+ * 所以崩溃在任何位置，打开时重做一遍即可
+ */
+static int redo_apply(struct ddriver *disk, struct redo_header *hdr, const char *data) {
+    uint32_t i;
+    int ret;
+
+    for (i = 0; i < hdr->count; i++) {
+        off_t offset = hdr->lbas[i] * disk->iounit_size;
+        const char *buf = data + (size_t)i * disk->iounit_size;
+
+        if ((ret = snap_preserve(disk, offset, disk->iounit_size)) < 0)
+            return ret;
+        elide_invalidate(disk, offset, disk->iounit_size);
+        if (disk->cache != NULL) {
+            if ((ret = cache_write(disk, buf, disk->iounit_size, offset)) < 0)
+                return ret;
+            continue;
+        }
+        if (IS_MAPPED(disk))
+            memcpy(disk->map + offset, buf, disk->iounit_size);
+        else if ((ret = image_write(disk, buf, disk->iounit_size, offset)) < 0)
+            return ret;
+        stat_io(disk, DDRIVER_OP_WRITE, offset, disk->iounit_size);
+    }
+    if (disk->cache != NULL && (ret = cache_flush(disk)) < 0)
+        return ret;
+    if (IS_MAPPED(disk) && msync(disk->map, disk->layout_size, MS_SYNC) < 0)
+        return -errno;
+    return fdatasync(disk->ddriver_fd) < 0 ? -errno : 0;
+}
+/**
+ * @brief 清掉记录头。不必落盘：残留的记录重做一遍结果不变。
+ * 原始镜像截回设备大小，文件长出设备末尾就说明有未清掉的记录
+ */
+static void redo_clear(struct ddriver *disk, char *rec) {
+    memset(rec, 0, disk->iounit_size);
+    pwrite(disk->ddriver_fd, rec, disk->iounit_size, disk->redo_offset);
+    if (disk->image == NULL)
+        ftruncate(disk->ddriver_fd, disk->redo_offset);
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 原始镜像预分配之前调用。原始镜像没有头，只能从文件长度看出设备大小：
+ * 应正好是设备大小，或其后跟着以本设备大小写下的记录。否则镜像是以另一个
+ * DDRIVER_DISK_SZ建的，记录(如果有)不在layout_size处，拒绝打开
+ *
+ * @param file_size 镜像文件当前长度，0为新镜像
+ * @return int
+ */
+int redo_check_raw(struct ddriver *disk, off_t file_size) {
+    struct redo_header hdr;
+    off_t tail = file_size - disk->layout_size;
+
+    if (file_size == 0 || tail == 0)
+        return 0;
+    if (tail > 0 && tail % disk->iounit_size == 0 &&
+        tail <= (off_t)(DDRIVER_ATOMIC_MAX + 1) * disk->iounit_size &&
+        pread(disk->ddriver_fd, &hdr, sizeof(hdr), disk->layout_size) == sizeof(hdr) &&
+        (hdr.magic == 0 || (hdr.magic == REDO_MAGIC && hdr.version == REDO_VERSION &&
+                            hdr.layout_size == (uint64_t)disk->layout_size)))
+        return 0;
+    user_alert("%s is %lld bytes but the device is %lld, open it with the size it was created with",
+               disk->path, (long long)file_size, (long long)disk->layout_size);
+    return -EINVAL;
+}
+/**
+ * @brief 打开设备时调用，在缓存与映射建立之前。
+ * 有校验通过的重做记录则写回原位，说明上次在原子写应用到一半时退出
+ *
+ * @return int 重做的IO单位数
+ */
+int redo_recover(struct ddriver *disk) {
+    struct redo_header *hdr;
+    char *rec;
+    size_t len;
+    uint64_t csum;
+    uint32_t i;
+    int ret;
+
+    if ((rec = (char *)malloc((size_t)(DDRIVER_ATOMIC_MAX + 1) * disk->iounit_size)) == NULL)
+        return -ENOMEM;
+    hdr = (struct redo_header *)rec;
+    if (pread(disk->ddriver_fd, rec, disk->iounit_size, disk->redo_offset) !=
+            disk->iounit_size || hdr->magic != REDO_MAGIC) {
+        free(rec);
+        return 0;
+    }
+    if (hdr->version != REDO_VERSION || hdr->iounit_size != (uint32_t)disk->iounit_size ||
+        hdr->layout_size != (uint64_t)disk->layout_size || hdr->count == 0 || hdr->count > DDRIVER_ATOMIC_MAX) {
+        user_alert("ignore redo record of another geometry");
+        free(rec);
+        return 0;
+    }
+
+    len  = (size_t)(hdr->count + 1) * disk->iounit_size;
+    csum = hdr->csum;
+    hdr->csum = 0;
+    if (pread(disk->ddriver_fd, rec + disk->iounit_size, len - disk->iounit_size,
+              disk->redo_offset + disk->iounit_size) != (ssize_t)(len - disk->iounit_size) ||
+        redo_csum(rec, len) != csum) {
+        user_info("drop torn redo record %llu", (unsigned long long)hdr->seq);
+        redo_clear(disk, rec);
+        free(rec);
+        return 0;
+    }
+    for (i = 0; i < hdr->count; i++) {
+        if ((off_t)(hdr->lbas[i] + 1) * disk->iounit_size > disk->layout_size) {
+            user_alert("ignore redo record beyond the device end");
+            free(rec);
+            return 0;
+        }
+    }
+
+    disk->redo_seq = hdr->seq;
+    if ((ret = redo_apply(disk, hdr, rec + disk->iounit_size)) < 0) {
+        user_alert("redo record %llu failed: %d", (unsigned long long)hdr->seq, ret);
+        free(rec);
+        return ret;
+    }
+    ret = hdr->count;
+    user_info("redo %d blocks of atomic write %llu", ret, (unsigned long long)hdr->seq);
+    redo_clear(disk, rec);
+    free(rec);
+    return ret;
+}
+/**
+ * @brief IOC_REQ_DEVICE_ATOMIC_WRITE：先把所有IO单位连同校验和写成一条记录并落盘，
+ * 再写到原位，最后清掉记录。需持io_lock写锁且无在途异步请求，
+ * 其他线程看到的要么是全部写入前，要么是全部写入后
+ *
+ * @param aw
+ * @return int 写入的IO单位数
+ */
+int redo_atomic_write(struct ddriver *disk, struct ddriver_atomic_write *aw) {
+    unsigned long long start = stat_now();
+    struct redo_header *hdr;
+    size_t len;
+    char *rec;
+    int i, ret;
+
+    if (aw == NULL || aw->count <= 0 || aw->count > DDRIVER_ATOMIC_MAX || aw->vecs == NULL)
+        return -EINVAL;
+    for (i = 0; i < aw->count; i++) {
+        if (aw->vecs[i].buf == NULL || check_pio(disk, aw->vecs[i].offset, disk->iounit_size) < 0)
+            return -EINVAL;
+    }
+
+    len = (size_t)(aw->count + 1) * disk->iounit_size;
+    if ((rec = (char *)calloc(1, len)) == NULL)
+        return -ENOMEM;
+    hdr = (struct redo_header *)rec;
+    hdr->magic       = REDO_MAGIC;
+    hdr->version     = REDO_VERSION;
+    hdr->iounit_size = disk->iounit_size;
+    hdr->count       = aw->count;
+    hdr->seq         = ++disk->redo_seq;
+    hdr->layout_size = disk->layout_size;
+    for (i = 0; i < aw->count; i++) {
+        hdr->lbas[i] = aw->vecs[i].offset / disk->iounit_size;
+        memcpy(rec + (size_t)(i + 1) * disk->iounit_size, aw->vecs[i].buf, disk->iounit_size);
+        trace_record(disk, TRACE_OP_WRITE, aw->vecs[i].offset, disk->iounit_size);
+    }
+    hdr->csum = redo_csum(rec, len);
+
+    if (pwrite(disk->ddriver_fd, rec, len, disk->redo_offset) != (ssize_t)len ||
+        fdatasync(disk->ddriver_fd) < 0) {
+        ret = errno != 0 ? -errno : -ENOSPC;
+        user_alert("write redo record failed: %d", ret);
+        redo_clear(disk, rec);
+        free(rec);
+        return ret;
+    }
+    if ((ret = redo_apply(disk, hdr, rec + disk->iounit_size)) < 0) {
+        user_alert("apply atomic write %llu failed: %d, redo at next open",
+                   (unsigned long long)hdr->seq, ret);
+        free(rec);
+        return ret;
+    }
+    redo_clear(disk, rec);
+    free(rec);
+
+    stat_latency(disk, DDRIVER_LAT_WRITE, start);
+    stat_tag(disk, stat_get_tag(), DDRIVER_OP_WRITE, (size_t)aw->count * disk->iounit_size,
+             start);
+    return aw->count;
+}
@@ -0,0 +1,146 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include <errno.h>
+#include "string.h"
+#include "ddriver_internal.h"
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+struct sched_ent
+{
+    off_t               offset;
+    int                 idx;                          /* Into the caller's reqs */
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static int sched_cmp(const void *a, const void *b) {
+    const struct sched_ent *x = (const struct sched_ent *)a;
+    const struct sched_ent *y = (const struct sched_ent *)b;
+
+    if (x->offset != y->offset)
+        return x->offset < y->offset ? -1 : 1;
+    return x->idx - y->idx;                           /* Same start keeps submission order */
+}
+/**
+ * @brief 从head出发按给定顺序执行时的寻道次数，与stat_io的计法一致
+ */
+static int sched_seeks(struct ddriver_req *reqs, struct sched_ent *ents, int n, off_t head) {
+    int i, seeks = 0;
+
+    for (i = 0; i < n; i++) {
+        struct ddriver_req *req = &reqs[ents[i].idx];
+        if (req->offset != head)
+            seeks++;
+        head = req->offset + (off_t)req->size;
+    }
+    return seeks;
+}
+/**
+ * @brief 执行合并后的一段：单个请求直接交给do_io，多个请求经过回弹缓冲区拼成一次设备IO
+ */
+static int sched_run(struct ddriver *disk, struct ddriver_req *reqs, struct sched_ent *ents,
+                     int cnt, size_t size, char *bounce) {
+    struct ddriver_req *first = &reqs[ents[0].idx];
+    size_t done;
+    int i, ret;
+
+    if (cnt == 1)
+        return do_io(disk, first->op, first->buf, first->size, first->offset);
+
+    if (first->op == DDRIVER_OP_WRITE) {
+        for (i = 0, done = 0; i < cnt; done += reqs[ents[i].idx].size, i++)
+            memcpy(bounce + done, reqs[ents[i].idx].buf, reqs[ents[i].idx].size);
+    }
+    if ((ret = do_io(disk, first->op, bounce, size, first->offset)) < 0)
+        return ret;
+    if (first->op == DDRIVER_OP_READ) {
+        for (i = 0, done = 0; i < cnt; done += reqs[ents[i].idx].size, i++)
+            memcpy(reqs[ents[i].idx].buf, bounce + done, reqs[ents[i].idx].size);
+    }
+    ATOMIC_ADD(disk->sched_merges, cnt - 1);
+    return ret;
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 同步执行一批无序请求：按起始偏移排序后以C-LOOK顺序，从当前磁头向高地址扫到底，
+ * 再回到最低地址继续，相邻且同向的请求合并为一次不超过CONFIG_SCHED_MERGE_SZ的设备IO。
+ * 省下的寻道数(按提交顺序执行的寻道数减去调度后的)计入sched_seeks_saved。
+ * 批内请求的执行顺序不定，相互重叠的请求只保证起点相同者按提交顺序
+ *
+ * @param fd
+ * @param reqs 请求数组，user_data不使用
+ * @param n
+ * @return int 完成的请求数n，负数为第一个失败的设备IO的-errno，此前的请求已完成
+ */
+int ddriver_submit_batch(int fd, struct ddriver_req *reqs, int n) {
+    struct ddriver *disk = dev_get(fd);
+    struct sched_ent *ents;
+    char *bounce = NULL;
+    off_t head;
+    size_t size;
+    int i, start, cnt, ordered, ret = 0;
+
+    if (disk == NULL)
+        return -EBADF;
+    if (n <= 0 || reqs == NULL)
+        return n == 0 ? 0 : -EINVAL;
+    for (i = 0; i < n; i++) {
+        if (reqs[i].op != DDRIVER_OP_READ && reqs[i].op != DDRIVER_OP_WRITE)
+            return -EINVAL;
+        if ((ret = check_pio(disk, reqs[i].offset, reqs[i].size)) < 0)
+            return ret;
+    }
+    if ((ents = (struct sched_ent *)malloc(n * sizeof(struct sched_ent))) == NULL)
+        return -ENOMEM;
+
+    head = ATOMIC_LOAD(disk->head);
+    for (i = 0; i < n; i++) {
+        ents[i].offset = reqs[i].offset;
+        ents[i].idx    = i;
+    }
+    ordered = sched_seeks(reqs, ents, n, head);
+    qsort(ents, n, sizeof(struct sched_ent), sched_cmp);
+    for (start = 0; start < n && ents[start].offset < head; start++)
+        ;
+    if (start != 0 && start != n) {                   /* C-LOOK: [head, end), then [0, head) */
+        struct sched_ent *rot = (struct sched_ent *)malloc(n * sizeof(struct sched_ent));
+        if (rot != NULL) {
+            memcpy(rot, ents + start, (n - start) * sizeof(struct sched_ent));
+            memcpy(rot + n - start, ents, start * sizeof(struct sched_ent));
+            free(ents);
+            ents = rot;
+        }
+    }
+
+    for (start = 0; start < n; start += cnt) {
+        struct ddriver_req *first = &reqs[ents[start].idx];
+        size = first->size;
+        for (cnt = 1; start + cnt < n; cnt++) {
+            struct ddriver_req *next = &reqs[ents[start + cnt].idx];
+            if (next->op != first->op || next->offset != first->offset + (off_t)size ||
+                size + next->size > CONFIG_SCHED_MERGE_SZ)
+                break;
+            size += next->size;
+        }
+        if (cnt > 1 && bounce == NULL &&
+            (bounce = (char *)malloc(CONFIG_SCHED_MERGE_SZ)) == NULL)
+            cnt = 1;                                  /* No memory, run them one by one */
+        if ((ret = sched_run(disk, reqs, ents + start, cnt, cnt == 1 ? first->size : size,
+                             bounce)) < 0)
+            break;
+    }
+
+    if (ret >= 0) {
+        i = ordered - sched_seeks(reqs, ents, n, head);
+        ATOMIC_ADD(disk->sched_batches, 1);
+        if (i > 0)
+            ATOMIC_ADD(disk->sched_seeks_saved, i);
+        ret = n;
+    }
+    free(bounce);
+    free(ents);
+    return ret;
+}
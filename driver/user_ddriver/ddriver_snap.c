@@ -0,0 +1,215 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "string.h"
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fs.h>
+#include "ddriver_internal.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define SNAP_BIT_TEST(map, i)   ((map)[(i) >> 3] & (1 << ((i) & 7)))
+#define SNAP_BIT_SET(map, i)    ((map)[(i) >> 3] |= (1 << ((i) & 7)))
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+enum snap_mode {
+    SNAP_CLONE,                                       /* <image>_snap shares extents by FICLONE */
+    SNAP_UNDO                                         /* Old content of units written since */
+};
+
+struct snap_ctx
+{
+    enum snap_mode      mode;
+    int                 fd;                           /* SNAP_CLONE: the snapshot file */
+    unsigned char      *saved;                        /* SNAP_UNDO: bitmap, 1 bit per IO unit */
+    off_t              *lbas;                         /* Saved units, in save order */
+    char               *data;                         /* nsaved * iounit_size */
+    long long           nsaved;
+    long long           cap;
+    pthread_mutex_t     lock;
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static void snap_path(struct ddriver *disk, char *buf, size_t len) {
+    snprintf(buf, len, "%s" DEVICE_SNAP, disk->path);
+}
+
+static struct snap_ctx *snap_alloc(enum snap_mode mode) {
+    struct snap_ctx *snap = (struct snap_ctx *)calloc(1, sizeof(struct snap_ctx));
+    if (snap == NULL)
+        return NULL;
+    snap->mode = mode;
+    snap->fd   = -1;
+    pthread_mutex_init(&snap->lock, NULL);
+    return snap;
+}
+
+static void snap_free(struct snap_ctx *snap) {
+    if (snap->fd >= 0)
+        close(snap->fd);
+    pthread_mutex_destroy(&snap->lock);
+    free(snap->saved);
+    free(snap->lbas);
+    free(snap->data);
+    free(snap);
+}
+
+static int snap_grow(struct ddriver *disk, struct snap_ctx *snap) {
+    long long cap = snap->cap ? snap->cap * 2 : 64;
+    off_t *lbas = (off_t *)realloc(snap->lbas, cap * sizeof(off_t));
+    char *data;
+
+    if (lbas == NULL)
+        return -ENOMEM;
+    snap->lbas = lbas;
+    data = (char *)realloc(snap->data, (size_t)cap * disk->iounit_size);
+    if (data == NULL)
+        return -ENOMEM;
+    snap->data = data;
+    snap->cap  = cap;
+    return 0;
+}
+/**
+ * @brief 尝试以FICLONE复制镜像，只共享extent，与镜像大小无关。
+ * 宿主文件系统不支持reflink(ext4, tmpfs等)时返回负数
+ */
+static int snap_clone(struct ddriver *disk, struct snap_ctx *snap) {
+    char path[PATH_MAX];
+
+    snap_path(disk, path, sizeof(path));
+    snap->fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (snap->fd < 0)
+        return -errno;
+    if (ioctl(snap->fd, FICLONE, disk->ddriver_fd) < 0) {
+        int err = errno;
+        close(snap->fd);
+        unlink(path);
+        snap->fd = -1;
+        return -err;
+    }
+    return 0;
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 为镜像打快照，覆盖上一个快照。需持io_lock写锁且无在途异步请求。
+ * 优先FICLONE出<image>_snap，不支持时改为内存undo log：
+ * 快照后每个IO单位第一次被改写前，先保存其旧内容
+ *
+ * @return int
+ */
+int snap_take(struct ddriver *disk) {
+    struct snap_ctx *snap;
+    int ret;
+
+    if (disk->cache != NULL && (ret = cache_flush(disk)) < 0)
+        return ret;
+    if (IS_MAPPED(disk))
+        msync(disk->map, disk->layout_size, MS_SYNC);
+    snap_teardown(disk);
+
+    if ((snap = snap_alloc(SNAP_CLONE)) == NULL)
+        return -ENOMEM;
+    if ((ret = snap_clone(disk, snap)) < 0) {
+        snap->mode  = SNAP_UNDO;
+        snap->saved = (unsigned char *)calloc(disk->layout_size / disk->iounit_size / 8 + 1, 1);
+        if (snap->saved == NULL) {
+            snap_free(snap);
+            return -ENOMEM;
+        }
+    }
+    disk->snap = snap;
+    user_info("snapshot by %s", snap->mode == SNAP_CLONE ? "reflink" : "undo log");
+    return 0;
+}
+/**
+ * @brief 回滚到快照，快照保留，可反复回滚。需持io_lock写锁且无在途异步请求。
+ * 本进程未打过快照时，沿用已有的<image>_snap
+ *
+ * @return int 没有快照返回-ENOENT
+ */
+int snap_rollback(struct ddriver *disk) {
+    struct snap_ctx *snap = disk->snap;
+    char path[PATH_MAX];
+    long long i;
+    int ret;
+
+    if (snap == NULL) {
+        if ((snap = snap_alloc(SNAP_CLONE)) == NULL)
+            return -ENOMEM;
+        snap_path(disk, path, sizeof(path));
+        if ((snap->fd = open(path, O_RDWR)) < 0) {
+            snap_free(snap);
+            return -ENOENT;
+        }
+        disk->snap = snap;
+    }
+
+    if (disk->cache != NULL)                          /* Writes since the snapshot are dropped */
+        cache_discard(disk, 0, disk->layout_size);
+    if (snap->mode == SNAP_CLONE)
+        return ioctl(disk->ddriver_fd, FICLONE, snap->fd) < 0 ? -errno : image_reload(disk);
+
+    for (i = 0; i < snap->nsaved; i++) {
+        off_t offset = snap->lbas[i] * disk->iounit_size;
+        char *buf = snap->data + (size_t)i * disk->iounit_size;
+        if (IS_MAPPED(disk))
+            memcpy(disk->map + offset, buf, disk->iounit_size);
+        else if ((ret = image_write(disk, buf, disk->iounit_size, offset)) < 0)
+            return ret;
+    }
+    memset(snap->saved, 0, disk->layout_size / disk->iounit_size / 8 + 1);
+    snap->nsaved = 0;
+    return 0;
+}
+/**
+ * @brief 改写设备[offset, offset + len)之前调用。undo log模式下保存其中
+ * 快照后尚未保存过的IO单位，其余模式直接返回
+ *
+ * @param offset 与IO单位对齐
+ * @param len
+ * @return int
+ */
+int snap_preserve(struct ddriver *disk, off_t offset, off_t len) {
+    struct snap_ctx *snap = disk->snap;
+    off_t lba, last = (offset + len) / disk->iounit_size;
+    char *buf;
+    int ret = 0;
+
+    if (snap == NULL || snap->mode != SNAP_UNDO)
+        return 0;
+    pthread_mutex_lock(&snap->lock);
+    for (lba = offset / disk->iounit_size; lba < last; lba++) {
+        if (SNAP_BIT_TEST(snap->saved, lba))
+            continue;
+        if (snap->nsaved == snap->cap && (ret = snap_grow(disk, snap)) < 0)
+            break;
+        buf = snap->data + (size_t)snap->nsaved * disk->iounit_size;
+        if (IS_MAPPED(disk)) {
+            memcpy(buf, disk->map + lba * disk->iounit_size, disk->iounit_size);
+        }
+        else if ((ret = image_read(disk, buf, disk->iounit_size, lba * disk->iounit_size)) < 0) {
+            break;
+        }
+        snap->lbas[snap->nsaved++] = lba;
+        SNAP_BIT_SET(snap->saved, lba);
+    }
+    pthread_mutex_unlock(&snap->lock);
+    return ret;
+}
+/**
+ * @brief 释放快照。reflink快照文件留在磁盘上，供之后的进程回滚
+ */
+void snap_teardown(struct ddriver *disk) {
+    if (disk->snap == NULL)
+        return;
+    snap_free(disk->snap);
+    disk->snap = NULL;
+}
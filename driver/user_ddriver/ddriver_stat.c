@@ -0,0 +1,219 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include <time.h>
+#include <errno.h>
+#include "ddriver_internal.h"
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+static __thread int io_tag;                          /* IOC_REQ_DEVICE_TAG, per thread */
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static int hist_bucket(unsigned long long val) {
+    int bucket;
+    if (val == 0)
+        return 0;
+    bucket = 63 - __builtin_clzll(val);
+    return bucket < DDRIVER_HIST_BUCKETS ? bucket : DDRIVER_HIST_BUCKETS - 1;
+}
+
+static void stat_distance(struct ddriver *disk, off_t from, off_t offset) {
+    off_t dis = offset > from ? offset - from : from - offset;
+    int bucket = 0;                                   /* [0]: sequential, [i]: [2^(i-1), 2^i) */
+
+    dis /= disk->iounit_size;
+    if (dis != 0) {
+        bucket = hist_bucket(dis) + 1;
+        if (bucket >= DDRIVER_HIST_BUCKETS)
+            bucket = DDRIVER_HIST_BUCKETS - 1;
+    }
+    ATOMIC_ADD(disk->seek_hist[bucket], 1);
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 单调时钟，纳秒
+ */
+unsigned long long stat_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/**
+ * @brief 记录一次读写请求：计数、字节数、寻道距离，起点与当前磁头不同则记一次隐式寻道。
+ * 计数均为原子操作，多线程并发调用时磁头按各请求实际到达的先后移动。
+ * 同时交给设备模型计时
+ *
+ * @param op DDRIVER_OP_READ / DDRIVER_OP_WRITE
+ * @param offset
+ * @param size
+ */
+void stat_io(struct ddriver *disk, int op, off_t offset, size_t size) {
+    off_t from = __atomic_exchange_n(&disk->head, offset + (off_t)size, __ATOMIC_RELAXED);
+
+    stat_distance(disk, from, offset);
+    model_charge(disk, from, offset, size);
+    heat_record(disk, op, offset, size);
+    if (from != offset)
+        INC_SEEKCNT(disk);
+
+    if (op == DDRIVER_OP_READ) {
+        ATOMIC_ADD(disk->read_cnt, size / disk->iounit_size);
+        ATOMIC_ADD(disk->read_bytes, size);
+    }
+    else {
+        ATOMIC_ADD(disk->write_cnt, size / disk->iounit_size);
+        ATOMIC_ADD(disk->write_bytes, size);
+    }
+}
+/**
+ * @brief 记录一次显式寻道 (ddriver_seek)
+ *
+ * @param offset 新的磁头位置
+ */
+void stat_seek(struct ddriver *disk, off_t offset) {
+    off_t from = __atomic_exchange_n(&disk->head, offset, __ATOMIC_RELAXED);
+
+    stat_distance(disk, from, offset);
+    INC_SEEKCNT(disk);
+}
+/**
+ * @brief 记录一次请求的延迟
+ *
+ * @param lat_op DDRIVER_LAT_开头
+ * @param start_ns stat_now()取得的开始时间
+ */
+void stat_latency(struct ddriver *disk, int lat_op, unsigned long long start_ns) {
+    ATOMIC_ADD(disk->lat_hist[lat_op][hist_bucket(stat_now() - start_ns)], 1);
+}
+/**
+ * @brief 调用线程当前的请求标签，异步请求在提交时取
+ */
+int stat_get_tag(void) {
+    return io_tag;
+}
+/**
+ * @brief 设置调用线程之后请求的标签，对该线程访问的所有设备生效
+ *
+ * @param tag [0, DDRIVER_TAGS)
+ * @return int
+ */
+int stat_set_tag(int tag) {
+    if (tag < 0 || tag >= DDRIVER_TAGS)
+        return -EINVAL;
+    io_tag = tag;
+    return 0;
+}
+/**
+ * @brief 请求完成时按标签记一次：请求数、字节数、延迟。
+ * 写回缓存下统计的是调用者的请求，而非刷回时的设备IO
+ *
+ * @param tag 提交时的标签
+ * @param op DDRIVER_OP_READ / DDRIVER_OP_WRITE
+ * @param size
+ * @param start_ns 提交时间
+ */
+void stat_tag(struct ddriver *disk, int tag, int op, size_t size, unsigned long long start_ns) {
+    struct ddriver_tag_stat *t = &disk->tags[tag];
+    unsigned long long lat = stat_now() - start_ns;
+
+    if (op == DDRIVER_OP_READ) {
+        ATOMIC_ADD(t->read_reqs, 1);
+        ATOMIC_ADD(t->read_bytes, size);
+        ATOMIC_ADD(t->read_lat_ns, lat);
+    }
+    else {
+        ATOMIC_ADD(t->write_reqs, 1);
+        ATOMIC_ADD(t->write_bytes, size);
+        ATOMIC_ADD(t->write_lat_ns, lat);
+    }
+}
+/**
+ * @brief 清零统计。IO已被io_lock挡住，但seek不持锁，仍需原子写
+ */
+void stat_reset(struct ddriver *disk) {
+    int i, op;
+
+    ATOMIC_STORE(disk->head, 0);
+    ATOMIC_STORE(disk->read_cnt, 0);
+    ATOMIC_STORE(disk->write_cnt, 0);
+    ATOMIC_STORE(disk->seek_cnt, 0);
+    ATOMIC_STORE(disk->read_bytes, 0);
+    ATOMIC_STORE(disk->write_bytes, 0);
+    ATOMIC_STORE(disk->cache_read_hits, 0);
+    ATOMIC_STORE(disk->cache_write_hits, 0);
+    ATOMIC_STORE(disk->cache_flush_runs, 0);
+    ATOMIC_STORE(disk->model_ns, 0);
+    ATOMIC_STORE(disk->model_throttle_ns, 0);
+    ATOMIC_STORE(disk->sched_batches, 0);
+    ATOMIC_STORE(disk->sched_merges, 0);
+    ATOMIC_STORE(disk->sched_seeks_saved, 0);
+    ATOMIC_STORE(disk->write_elided, 0);
+    model_reset(disk);
+    heat_reset(disk);
+    for (i = 0; i < DDRIVER_HIST_BUCKETS; i++) {
+        for (op = 0; op < DDRIVER_LAT_OPS; op++)
+            ATOMIC_STORE(disk->lat_hist[op][i], 0);
+        ATOMIC_STORE(disk->seek_hist[i], 0);
+    }
+    for (i = 0; i < DDRIVER_TAGS; i++) {
+        ATOMIC_STORE(disk->tags[i].read_reqs, 0);
+        ATOMIC_STORE(disk->tags[i].write_reqs, 0);
+        ATOMIC_STORE(disk->tags[i].read_bytes, 0);
+        ATOMIC_STORE(disk->tags[i].write_bytes, 0);
+        ATOMIC_STORE(disk->tags[i].read_lat_ns, 0);
+        ATOMIC_STORE(disk->tags[i].write_lat_ns, 0);
+    }
+}
+/**
+ * @brief 填充IOC_REQ_DEVICE_STATE_EXT，按调用者给出的size截断，兼容旧版本结构
+ *
+ * @param ext
+ * @return int
+ */
+int stat_fill_ext(struct ddriver *disk, struct ddriver_state_ext *ext) {
+    struct ddriver_state_ext full;
+    size_t size = ext->size;
+    int i, op;
+
+    if (ext->version < 1 || size < 2 * sizeof(int))
+        return -EINVAL;
+    if (size > sizeof(full))
+        size = sizeof(full);
+
+    memset(&full, 0, sizeof(full));
+    full.version     = DDRIVER_STATE_VERSION;
+    full.size        = size;
+    full.read_cnt    = ATOMIC_LOAD(disk->read_cnt);
+    full.write_cnt   = ATOMIC_LOAD(disk->write_cnt);
+    full.seek_cnt    = ATOMIC_LOAD(disk->seek_cnt);
+    full.read_bytes  = ATOMIC_LOAD(disk->read_bytes);
+    full.write_bytes = ATOMIC_LOAD(disk->write_bytes);
+    full.cache_read_hits  = ATOMIC_LOAD(disk->cache_read_hits);
+    full.cache_write_hits = ATOMIC_LOAD(disk->cache_write_hits);
+    full.cache_flush_runs = ATOMIC_LOAD(disk->cache_flush_runs);
+    full.model_ns         = ATOMIC_LOAD(disk->model_ns);
+    full.model_throttle_ns = ATOMIC_LOAD(disk->model_throttle_ns);
+    full.sched_batches     = ATOMIC_LOAD(disk->sched_batches);
+    full.sched_merges      = ATOMIC_LOAD(disk->sched_merges);
+    full.sched_seeks_saved = ATOMIC_LOAD(disk->sched_seeks_saved);
+    full.write_elided      = ATOMIC_LOAD(disk->write_elided);
+    for (i = 0; i < DDRIVER_HIST_BUCKETS; i++) {
+        for (op = 0; op < DDRIVER_LAT_OPS; op++)
+            full.lat_hist[op][i] = ATOMIC_LOAD(disk->lat_hist[op][i]);
+        full.seek_hist[i] = ATOMIC_LOAD(disk->seek_hist[i]);
+    }
+    for (i = 0; i < DDRIVER_TAGS; i++) {
+        full.tags[i].read_reqs    = ATOMIC_LOAD(disk->tags[i].read_reqs);
+        full.tags[i].write_reqs   = ATOMIC_LOAD(disk->tags[i].write_reqs);
+        full.tags[i].read_bytes   = ATOMIC_LOAD(disk->tags[i].read_bytes);
+        full.tags[i].write_bytes  = ATOMIC_LOAD(disk->tags[i].write_bytes);
+        full.tags[i].read_lat_ns  = ATOMIC_LOAD(disk->tags[i].read_lat_ns);
+        full.tags[i].write_lat_ns = ATOMIC_LOAD(disk->tags[i].write_lat_ns);
+    }
+    memcpy(ext, &full, size);
+    return 0;
+}
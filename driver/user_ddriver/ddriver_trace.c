@@ -0,0 +1,102 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "string.h"
+#include <sys/mman.h>
+#include "ddriver_internal.h"
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+struct trace_ctx
+{
+    int                  fd;
+    size_t               map_size;
+    struct trace_header *hdr;
+    struct trace_rec    *recs;
+    unsigned long long   start_ns;
+};
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 打开设备时调用，创建环形trace文件并映射，写满后覆盖最旧的记录
+ *
+ * @param path trace文件路径
+ * @param size 文件字节数，含文件头
+ * @return int
+ */
+int trace_setup(struct ddriver *disk, const char *path, long long size) {
+    long long capacity = (size - (long long)sizeof(struct trace_header)) /
+                         (long long)sizeof(struct trace_rec);
+    struct trace_ctx *trace;
+    void *map;
+    int ret;
+
+    if (capacity <= 0)
+        return -EINVAL;
+    if ((trace = (struct trace_ctx *)malloc(sizeof(struct trace_ctx))) == NULL)
+        return -ENOMEM;
+    trace->map_size = sizeof(struct trace_header) + capacity * sizeof(struct trace_rec);
+    trace->fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (trace->fd < 0) {
+        ret = -errno;
+        free(trace);
+        return ret;
+    }
+    if (ftruncate(trace->fd, trace->map_size) < 0 ||
+        (map = mmap(NULL, trace->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    trace->fd, 0)) == MAP_FAILED) {
+        ret = -errno;
+        close(trace->fd);
+        free(trace);
+        return ret;
+    }
+
+    trace->hdr  = (struct trace_header *)map;
+    trace->recs = (struct trace_rec *)(trace->hdr + 1);
+    trace->hdr->magic       = TRACE_MAGIC;
+    trace->hdr->version     = TRACE_VERSION;
+    trace->hdr->iounit_size = disk->iounit_size;
+    trace->hdr->rec_size    = sizeof(struct trace_rec);
+    trace->hdr->layout_size = disk->layout_size;
+    trace->hdr->capacity    = capacity;
+    trace->hdr->head        = 0;
+    trace->start_ns         = stat_now();
+    disk->trace = trace;
+    return 0;
+}
+
+void trace_teardown(struct ddriver *disk) {
+    struct trace_ctx *trace = disk->trace;
+    if (trace == NULL)
+        return;
+    msync(trace->hdr, trace->map_size, MS_SYNC);
+    munmap(trace->hdr, trace->map_size);
+    close(trace->fd);
+    free(trace);
+    disk->trace = NULL;
+}
+/**
+ * @brief 追加一条记录，多线程并发时各自原子地占用一个槽位
+ *
+ * @param op TRACE_OP_开头
+ * @param offset
+ * @param size
+ */
+void trace_record(struct ddriver *disk, int op, unsigned long long offset, unsigned int size) {
+    struct trace_ctx *trace = disk->trace;
+    struct trace_rec *rec;
+    unsigned long long slot;
+
+    if (trace == NULL)
+        return;
+    slot = __atomic_fetch_add(&trace->hdr->head, 1, __ATOMIC_RELAXED) % trace->hdr->capacity;
+    rec = &trace->recs[slot];
+    rec->ts_ns    = stat_now() - trace->start_ns;
+    rec->offset   = offset;
+    rec->size     = size;
+    rec->op       = op;
+    rec->reserved = 0;
+}
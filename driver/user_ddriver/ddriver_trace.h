@@ -0,0 +1,37 @@
+#ifndef _DDRIVER_TRACE_H_
+#define _DDRIVER_TRACE_H_
+
+#include <stdint.h>
+/******************************************************************************
+* SECTION: Trace file format, shared by ddriver_trace.c and tools/ddriver_replay.c
+*******************************************************************************/
+#define TRACE_MAGIC         0x52544444                  /* "DDTR" */
+#define TRACE_VERSION       1
+
+#define TRACE_OP_SEEK       0                           /* offset: new head */
+#define TRACE_OP_READ       1
+#define TRACE_OP_WRITE      2
+#define TRACE_OP_IOCTL      3                           /* offset: cmd, size: int arg if any */
+#define TRACE_OP_DISCARD    4                           /* size: in IO units */
+
+struct trace_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t iounit_size;
+    uint32_t rec_size;
+    uint64_t layout_size;
+    uint64_t capacity;                                /* Records in the ring */
+    uint64_t head;                                    /* Records ever written, slot = head % capacity */
+};
+
+struct trace_rec
+{
+    uint64_t ts_ns;                                   /* Since the device was opened */
+    uint64_t offset;
+    uint32_t size;
+    uint16_t op;
+    uint16_t reserved;
+};
+
+#endif /* _DDRIVER_TRACE_H_ */
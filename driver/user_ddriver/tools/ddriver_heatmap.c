@@ -0,0 +1,315 @@
+#define _GNU_SOURCE                                     /* qsort_r */
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "string.h"
+#include "../ddriver_heat.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define MAX_REGIONS         64
+#define BAR_WIDTH           64
+#define DEFAULT_ROWS        16
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+struct region
+{
+    char                name[32];
+    unsigned long long  start;                        /* In file-system blocks */
+    unsigned long long  len;
+};
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+static const char shades[] = " .:-=+*#%@";            /* Untouched, then log2 scaled */
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static void usage(void) {
+    printf("Usage: ddriver_heatmap [-B size] [-l layout] [-n top] [-b out] heat_file\n");
+    printf("  Summarize the <image>_heat file written with DDRIVER_HEATMAP=1.\n");
+    printf("  -B size    file-system block size in bytes, default the IO unit\n");
+    printf("  -l layout  name:start[:len],... in blocks, e.g. super:0:1,ibitmap:1:1,data:3\n");
+    printf("             a region without len runs to the next one or the end\n");
+    printf("  -n top     list the top hottest blocks, default 10\n");
+    printf("  -b out     write touched blocks as a compact binary dump instead\n");
+}
+
+static unsigned long long accesses(const struct heat_ent *ent) {
+    return (unsigned long long)ent->read_cnt + ent->write_cnt;
+}
+
+static int ilog2(unsigned long long val) {
+    return val == 0 ? -1 : 63 - __builtin_clzll(val);
+}
+/**
+ * @brief 读出热度文件，并按文件系统块大小合并IO单位：次数相加，epoch取最大
+ */
+static struct heat_ent *load_heat(const char *path, struct heat_header *hdr, int block_size,
+                                  unsigned long long *nblks) {
+    struct heat_ent *units, *blks;
+    unsigned long long i;
+    int per, fd = open(path, O_RDONLY);
+    size_t len;
+
+    if (fd < 0 || read(fd, hdr, sizeof(*hdr)) != sizeof(*hdr) ||
+        hdr->magic != HEAT_MAGIC || hdr->ent_size != sizeof(struct heat_ent)) {
+        fprintf(stderr, "%s: not a ddriver heatmap\n", path);
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    if (block_size == 0)
+        block_size = hdr->iounit_size;
+    if (block_size < (int)hdr->iounit_size || block_size % hdr->iounit_size != 0) {
+        fprintf(stderr, "block size %d is not a multiple of the IO unit %u\n",
+                block_size, hdr->iounit_size);
+        close(fd);
+        return NULL;
+    }
+    per    = block_size / hdr->iounit_size;
+    *nblks = (hdr->nblks + per - 1) / per;
+    len    = hdr->nblks * sizeof(struct heat_ent);
+    units  = (struct heat_ent *)malloc(len + 1);
+    blks   = (struct heat_ent *)calloc(*nblks + 1, sizeof(struct heat_ent));
+    if (units == NULL || blks == NULL || read(fd, units, len) != (ssize_t)len) {
+        fprintf(stderr, "%s: truncated\n", path);
+        free(units);
+        free(blks);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    for (i = 0; i < hdr->nblks; i++) {
+        struct heat_ent *blk = &blks[i / per];
+        blk->read_cnt  += units[i].read_cnt;
+        blk->write_cnt += units[i].write_cnt;
+        if (units[i].last_epoch > blk->last_epoch)
+            blk->last_epoch = units[i].last_epoch;
+    }
+    free(units);
+    return blks;
+}
+/**
+ * @brief 解析name:start[:len],...，省略len的区域延伸到下一个区域或设备末尾
+ */
+static int parse_layout(char *spec, struct region *regions, unsigned long long nblks) {
+    char *tok, *save = NULL;
+    int i, n = 0;
+
+    for (tok = strtok_r(spec, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        char *colon = strchr(tok, ':');
+        char *end;
+
+        if (n == MAX_REGIONS || colon == NULL || colon - tok >= (int)sizeof(regions[n].name))
+            return -EINVAL;
+        memcpy(regions[n].name, tok, colon - tok);
+        regions[n].name[colon - tok] = '\0';
+        regions[n].start = strtoull(colon + 1, &end, 0);
+        regions[n].len   = *end == ':' ? strtoull(end + 1, NULL, 0) : 0;
+        if (regions[n].start >= nblks)
+            return -EINVAL;
+        n++;
+    }
+    for (i = 0; i < n; i++) {
+        unsigned long long limit = i + 1 < n ? regions[i + 1].start : nblks;
+        if (regions[i].len == 0 || regions[i].start + regions[i].len > nblks)
+            regions[i].len = limit > regions[i].start ? limit - regions[i].start
+                                                      : nblks - regions[i].start;
+    }
+    return n;
+}
+
+static int default_layout(struct region *regions, unsigned long long nblks) {
+    unsigned long long step = (nblks + DEFAULT_ROWS - 1) / DEFAULT_ROWS;
+    int n = 0;
+
+    for (; n < DEFAULT_ROWS && (unsigned long long)n * step < nblks; n++) {
+        regions[n].start = n * step;
+        regions[n].len   = regions[n].start + step > nblks ? nblks - regions[n].start : step;
+        snprintf(regions[n].name, sizeof(regions[n].name), "#%d", n);
+    }
+    return n;
+}
+/**
+ * @brief 一个区域一行：块范围、访问过的块数、读写次数、最近访问距今多少个请求，
+ * 以及按log2缩放到全盘最热块的热度条，每个字符代表区域内连续的若干块中最热的一块
+ */
+static void print_region(const struct region *r, const struct heat_ent *blks,
+                         unsigned long long epoch, int max_log) {
+    unsigned long long reads = 0, writes = 0, touched = 0, last = 0, i;
+    unsigned long long width = r->len < BAR_WIDTH ? r->len : BAR_WIDTH;
+    char bar[BAR_WIDTH + 1];
+    int col;
+
+    for (i = r->start; i < r->start + r->len; i++) {
+        reads  += blks[i].read_cnt;
+        writes += blks[i].write_cnt;
+        touched += accesses(&blks[i]) != 0;
+        if (blks[i].last_epoch > last)
+            last = blks[i].last_epoch;
+    }
+    for (col = 0; col < (int)width; col++) {
+        unsigned long long from = r->start + r->len * col / width;
+        unsigned long long to   = r->start + r->len * (col + 1) / width;
+        unsigned long long hot  = 0;
+        for (i = from; i < to; i++)
+            if (accesses(&blks[i]) > hot)
+                hot = accesses(&blks[i]);
+        bar[col] = hot == 0 ? shades[0]
+                            : shades[1 + (ilog2(hot) * (int)(sizeof(shades) - 3)) /
+                                         (max_log > 0 ? max_log : 1)];
+    }
+    bar[width] = '\0';
+
+    printf("%-10s %8llu %8llu %8llu/%-8llu %10llu %10llu ", r->name, r->start,
+           r->start + r->len, touched, r->len, reads, writes);
+    if (last != 0)
+        printf("%10llu", epoch - last);
+    else
+        printf("%10s", "-");
+    printf("  |%s|\n", bar);
+}
+
+static int cmp_hot(const void *a, const void *b, void *arg) {
+    const struct heat_ent *blks = (const struct heat_ent *)arg;
+    unsigned long long x = accesses(&blks[*(const unsigned long long *)a]);
+    unsigned long long y = accesses(&blks[*(const unsigned long long *)b]);
+    return x > y ? -1 : x < y;
+}
+
+static const char *region_of(const struct region *regions, int n, unsigned long long blk) {
+    int i;
+    for (i = 0; i < n; i++)
+        if (blk >= regions[i].start && blk < regions[i].start + regions[i].len)
+            return regions[i].name;
+    return "-";
+}
+
+static void print_top(const struct heat_ent *blks, unsigned long long nblks, int top,
+                      const struct region *regions, int n, unsigned long long epoch) {
+    unsigned long long *order, i, touched = 0;
+
+    if (top <= 0 || (order = (unsigned long long *)malloc(nblks * sizeof(*order))) == NULL)
+        return;
+    for (i = 0; i < nblks; i++)
+        if (accesses(&blks[i]) != 0)
+            order[touched++] = i;
+    qsort_r(order, touched, sizeof(*order), cmp_hot, (void *)blks);
+    printf("\n%-10s %-10s %10s %10s %10s\n", "block", "region", "reads", "writes", "age");
+    for (i = 0; i < touched && i < (unsigned long long)top; i++) {
+        const struct heat_ent *ent = &blks[order[i]];
+        printf("%-10llu %-10s %10u %10u %10llu\n", order[i], region_of(regions, n, order[i]),
+               ent->read_cnt, ent->write_cnt, epoch - ent->last_epoch);
+    }
+    free(order);
+}
+/**
+ * @brief 只输出访问过的块，heat_sparse_header之后跟count条heat_sparse_rec
+ */
+static int dump_sparse(const char *path, const struct heat_ent *blks, unsigned long long nblks,
+                       int block_size, unsigned long long epoch) {
+    struct heat_sparse_header hdr;
+    struct heat_sparse_rec rec;
+    unsigned long long i;
+    FILE *out = fopen(path, "wb");
+
+    if (out == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic      = HEAT_SPARSE_MAGIC;
+    hdr.block_size = block_size;
+    hdr.nblks      = nblks;
+    hdr.epoch      = epoch;
+    for (i = 0; i < nblks; i++)
+        hdr.count += accesses(&blks[i]) != 0;
+    fwrite(&hdr, sizeof(hdr), 1, out);
+
+    memset(&rec, 0, sizeof(rec));
+    for (i = 0; i < nblks; i++) {
+        if (accesses(&blks[i]) == 0)
+            continue;
+        rec.blk        = i;
+        rec.read_cnt   = blks[i].read_cnt;
+        rec.write_cnt  = blks[i].write_cnt;
+        rec.last_epoch = blks[i].last_epoch;
+        fwrite(&rec, sizeof(rec), 1, out);
+    }
+    if (fclose(out) != 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    printf("%llu of %llu blocks written to %s\n", (unsigned long long)hdr.count, nblks, path);
+    return 0;
+}
+/******************************************************************************
+* SECTION: Main
+*******************************************************************************/
+int main(int argc, char *argv[]) {
+    struct heat_header hdr;
+    struct heat_ent *blks;
+    struct region regions[MAX_REGIONS];
+    unsigned long long nblks, i, hottest = 0;
+    char *layout = NULL, *dump = NULL;
+    int opt, n, block_size = 0, top = 10, ret = 0;
+
+    while ((opt = getopt(argc, argv, "B:l:n:b:h")) != -1) {
+        switch (opt)
+        {
+        case 'B':
+            block_size = atoi(optarg);
+            break;
+        case 'l':
+            layout = optarg;
+            break;
+        case 'n':
+            top = atoi(optarg);
+            break;
+        case 'b':
+            dump = optarg;
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+        return 1;
+    }
+    if ((blks = load_heat(argv[optind], &hdr, block_size, &nblks)) == NULL)
+        return 1;
+    if (block_size == 0)
+        block_size = hdr.iounit_size;
+
+    if (dump != NULL) {
+        ret = dump_sparse(dump, blks, nblks, block_size, hdr.epoch);
+        free(blks);
+        return ret;
+    }
+
+    n = layout != NULL ? parse_layout(layout, regions, nblks) : default_layout(regions, nblks);
+    if (n < 0) {
+        fprintf(stderr, "bad layout, expect name:start[:len],... within %llu blocks\n", nblks);
+        free(blks);
+        return 1;
+    }
+    for (i = 0; i < nblks; i++)
+        if (accesses(&blks[i]) > hottest)
+            hottest = accesses(&blks[i]);
+
+    printf("%llu blocks of %d B, %u requests recorded\n\n", nblks, block_size, hdr.epoch);
+    printf("%-10s %8s %8s %17s %10s %10s %10s\n", "region", "start", "end", "touched",
+           "reads", "writes", "age");
+    for (opt = 0; opt < n; opt++)
+        print_region(&regions[opt], blks, hdr.epoch, ilog2(hottest));
+    print_top(blks, nblks, top, regions, n, hdr.epoch);
+    free(blks);
+    return ret;
+}
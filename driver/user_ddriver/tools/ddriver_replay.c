@@ -0,0 +1,292 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "string.h"
+#include <time.h>
+#include <limits.h>
+#include "../include/ddriver.h"
+#include "../ddriver_internal.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define NSEC_PER_SEC        (1000000000ULL)
+#define SCRATCH_TEMPLATE    "/tmp/ddriver_replay_XXXXXX"
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+struct lat_set
+{
+    unsigned long long *lat;
+    long long           cnt;
+    unsigned long long  bytes;
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static void usage(void) {
+    printf("Usage: ddriver_replay [-t] trace_file [image]\n");
+    printf("  Replay a trace captured with DDRIVER_TRACE against a fresh image with the\n");
+    printf("  trace's geometry. A named image is reset first; without one a scratch\n");
+    printf("  image under /tmp is used and removed afterwards.\n");
+    printf("  -t    keep the original inter-request timing, default as fast as possible\n");
+    printf("  Other DDRIVER_* variables (MMAP, CACHE, MODEL, ...) apply as usual.\n");
+}
+/**
+ * @brief Same environment as ddriver_open, but the geometry comes from the trace
+ */
+static void replay_options(struct ddriver_options *opts, struct trace_header *hdr) {
+    char *env;
+
+    memset(opts, 0, sizeof(*opts));
+    opts->disk_size   = (long long)hdr->layout_size;
+    opts->iounit_size = (int)hdr->iounit_size;
+    opts->model       = DDRIVER_MODEL_NONE;
+    opts->log_level   = DDRIVER_LOG_DEFAULT;
+    if ((env = getenv(ENV_MMAP)) != NULL && atoi(env) != 0)
+        opts->flags |= DDRIVER_OPT_MMAP;
+    if ((env = getenv(ENV_SLEEP)) != NULL && atoi(env) != 0)
+        opts->flags |= DDRIVER_OPT_SLEEP;
+    if ((env = getenv(ENV_HEATMAP)) != NULL && atoi(env) != 0)
+        opts->flags |= DDRIVER_OPT_HEATMAP;
+    if ((env = getenv(ENV_SPARSE)) != NULL && atoi(env) != 0)
+        opts->flags |= DDRIVER_OPT_SPARSE;
+    if ((env = getenv(ENV_ELIDE)) != NULL && atoi(env) != 0)
+        opts->flags |= DDRIVER_OPT_ELIDE;
+    if ((env = getenv(ENV_QD)) != NULL)
+        opts->queue_depth = atoi(env);
+    if ((env = getenv(ENV_CACHE)) != NULL)
+        opts->cache_size = parse_size(env);
+    if ((env = getenv(ENV_MODEL)) != NULL)
+        opts->model = model_lookup(env);
+    if ((env = getenv(ENV_BW)) != NULL)
+        opts->bw_limit = parse_size(env);
+    if ((env = getenv(ENV_LOG)) != NULL)
+        opts->log_level = log_lookup(env);
+}
+
+static void remove_scratch(const char *path) {
+    char aux[PATH_MAX];
+    unlink(path);
+    snprintf(aux, sizeof(aux), "%s" DEVICE_LOG, path);
+    unlink(aux);
+    snprintf(aux, sizeof(aux), "%s" DEVICE_HEAT, path);
+    unlink(aux);
+}
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void sleep_until(unsigned long long deadline) {
+    struct timespec ts;
+    unsigned long long now = now_ns();
+    if (deadline <= now)
+        return;
+    ts.tv_sec  = (deadline - now) / NSEC_PER_SEC;
+    ts.tv_nsec = (deadline - now) % NSEC_PER_SEC;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+static int cmp_ull(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, struct lat_set *set, double secs) {
+    static const double pcts[] = { 50, 90, 99, 99.9 };
+    int i;
+
+    if (set->cnt == 0)
+        return;
+    qsort(set->lat, set->cnt, sizeof(unsigned long long), cmp_ull);
+    printf("%-6s %10lld ops %12.0f IOPS %10.2f MiB/s  lat(us)", name, set->cnt,
+           set->cnt / secs, set->bytes / secs / (1024 * 1024));
+    for (i = 0; i < (int)(sizeof(pcts) / sizeof(pcts[0])); i++)
+        printf(" p%g %.1f", pcts[i],
+               set->lat[(long long)(set->cnt * pcts[i] / 100)] / 1000.0);
+    printf(" max %.1f\n", set->lat[set->cnt - 1] / 1000.0);
+}
+/**
+ * @brief 按环形顺序读出trace，写满过的文件从最旧的记录开始
+ */
+static struct trace_rec *load_trace(const char *path, struct trace_header *hdr, long long *n) {
+    struct trace_rec *recs;
+    unsigned long long first;
+    long long i;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || read(fd, hdr, sizeof(*hdr)) != sizeof(*hdr) ||
+        hdr->magic != TRACE_MAGIC || hdr->rec_size != sizeof(struct trace_rec)) {
+        fprintf(stderr, "%s: not a ddriver trace\n", path);
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    *n    = hdr->head < hdr->capacity ? hdr->head : hdr->capacity;
+    first = hdr->head < hdr->capacity ? 0 : hdr->head % hdr->capacity;
+    recs  = (struct trace_rec *)malloc((*n + 1) * sizeof(struct trace_rec));
+    for (i = 0; recs != NULL && i < *n; i++) {
+        off_t pos = sizeof(*hdr) + ((first + i) % hdr->capacity) * sizeof(struct trace_rec);
+        if (pread(fd, &recs[i], sizeof(struct trace_rec), pos) != sizeof(struct trace_rec)) {
+            fprintf(stderr, "%s: truncated\n", path);
+            free(recs);
+            recs = NULL;
+        }
+    }
+    close(fd);
+    return recs;
+}
+/**
+ * @brief 只重放会改变设备内容或刷盘的ioctl，查询类的跳过
+ */
+static void replay_ioctl(int fd, struct trace_rec *rec) {
+    int flags = rec->size;
+    switch (rec->offset)
+    {
+    case IOC_REQ_DEVICE_RESET:
+    case IOC_REQ_DEVICE_SYNC:
+    case IOC_REQ_DEVICE_SNAPSHOT:
+    case IOC_REQ_DEVICE_ROLLBACK:
+        ddriver_ioctl(fd, rec->offset, NULL);
+        break;
+    case IOC_REQ_DEVICE_FLUSH:
+        ddriver_ioctl(fd, rec->offset, &flags);
+        break;
+    default:
+        break;
+    }
+}
+/******************************************************************************
+* SECTION: Main
+*******************************************************************************/
+int main(int argc, char *argv[]) {
+    struct trace_header hdr;
+    struct trace_rec *recs;
+    struct ddriver_discard discard;
+    struct ddriver_state_ext ext;
+    struct lat_set sets[2] = { { NULL, 0, 0 }, { NULL, 0, 0 } };
+    struct ddriver_options opts;
+    char path[PATH_MAX];
+    char *buf;
+    long long n, i;
+    unsigned long long start, t0, elapsed, max_size = 0;
+    int fd, opt, timed = 0, scratch;
+
+    while ((opt = getopt(argc, argv, "th")) != -1) {
+        switch (opt)
+        {
+        case 't':
+            timed = 1;
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1 && optind != argc - 2) {
+        usage();
+        return 1;
+    }
+    if ((recs = load_trace(argv[optind], &hdr, &n)) == NULL)
+        return 1;
+
+    replay_options(&opts, &hdr);                      /* No trace_path: never trace into the input */
+    scratch = optind == argc - 1;
+    if (scratch) {
+        strcpy(path, SCRATCH_TEMPLATE);
+        if ((fd = mkstemp(path)) < 0) {
+            fprintf(stderr, "can't create scratch image: %s\n", strerror(errno));
+            return 1;
+        }
+        close(fd);
+    }
+    else {
+        snprintf(path, sizeof(path), "%s", argv[optind + 1]);
+    }
+    if ((fd = ddriver_open_opts(path, &opts)) < 0) {
+        fprintf(stderr, "can't open %s: %d\n", path, fd);
+        if (scratch)
+            remove_scratch(path);
+        return 1;
+    }
+    if (!scratch)                                     /* The caller named it, start it fresh */
+        ddriver_ioctl(fd, IOC_REQ_DEVICE_RESET, NULL);
+
+    for (i = 0; i < n; i++) {
+        if ((recs[i].op == TRACE_OP_READ || recs[i].op == TRACE_OP_WRITE) &&
+            recs[i].size > max_size)
+            max_size = recs[i].size;
+    }
+    buf = (char *)malloc(max_size + 1);
+    sets[0].lat = (unsigned long long *)malloc((n + 1) * sizeof(unsigned long long));
+    sets[1].lat = (unsigned long long *)malloc((n + 1) * sizeof(unsigned long long));
+    if (buf == NULL || sets[0].lat == NULL || sets[1].lat == NULL) {
+        fprintf(stderr, "out of memory\n");
+        ddriver_close(fd);
+        if (scratch)
+            remove_scratch(path);
+        return 1;
+    }
+    memset(buf, 0x5a, max_size);
+
+    start = now_ns();
+    for (i = 0; i < n; i++) {
+        struct trace_rec *rec = &recs[i];
+        struct lat_set *set;
+
+        if (timed)
+            sleep_until(start + (rec->ts_ns - recs[0].ts_ns));
+        switch (rec->op)
+        {
+        case TRACE_OP_SEEK:
+            ddriver_seek(fd, rec->offset, SEEK_SET);
+            break;
+        case TRACE_OP_READ:
+        case TRACE_OP_WRITE:
+            set = &sets[rec->op == TRACE_OP_WRITE];
+            t0  = now_ns();
+            if (rec->op == TRACE_OP_READ)
+                ddriver_pread(fd, buf, rec->size, rec->offset);
+            else
+                ddriver_pwrite(fd, buf, rec->size, rec->offset);
+            set->lat[set->cnt++] = now_ns() - t0;
+            set->bytes += rec->size;
+            break;
+        case TRACE_OP_DISCARD:
+            discard.offset = rec->offset;
+            discard.len    = (long long)rec->size * hdr.iounit_size;
+            ddriver_ioctl(fd, IOC_REQ_DEVICE_DISCARD, &discard);
+            break;
+        case TRACE_OP_IOCTL:
+            replay_ioctl(fd, rec);
+            break;
+        default:
+            break;
+        }
+    }
+    elapsed = now_ns() - start;
+
+    printf("%lld records in %.3f s (%s)\n", n, elapsed / 1e9,
+           timed ? "original timing" : "as fast as possible");
+    report("read", &sets[0], elapsed / 1e9);
+    report("write", &sets[1], elapsed / 1e9);
+    ext.version = DDRIVER_STATE_VERSION;
+    ext.size    = sizeof(ext);
+    if (ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE_EXT, &ext) == 0 && ext.model_ns != 0)
+        printf("modeled device time %.3f ms\n", ext.model_ns / 1e6);
+
+    ddriver_close(fd);
+    if (scratch)
+        remove_scratch(path);
+    free(buf);
+    free(sets[0].lat);
+    free(sets[1].lat);
+    free(recs);
+    return 0;
+}
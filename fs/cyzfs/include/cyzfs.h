@@ -13,8 +13,9 @@
 #include "errno.h"
 #include "types.h"
 
-#define CYZFS_MAGIC       87654233   /* TODO: Define by yourself */
+#define CYZFS_MAGIC       87654234   /* TODO: Define by yourself，inode加入间接块后换新 */
 #define CYZFS_DEFAULT_PERM    0777   /* 全权限打开 */
+#define CYZFS_XATTR_BCACHE    "user.cyzfs.bcache"   /* getxattr: 块缓存统计 */
 
 /******************************************************************************
 * SECTION: cyzfs.c
@@ -22,14 +23,26 @@
 
 int assemble_read(int, char *, int);
 int assemble_write(int offset, char *buf, int size);
+void assemble_tag(CYZFS_IO_TAG);
+int assemble_commit(struct cyzfs_part*, int);
+void assemble_bcache_init(void);
+void assemble_bcache_free(void);
+struct cyzfs_buf* assemble_bget(int, int);
+void assemble_brelse(struct cyzfs_buf*, int);
+int assemble_flush(void);
 struct cyzfs_dentry* assemble_new_dentry(char *, CYZFS_FILE_TYPE);
 struct cyzfs_inode* assemble_alloc_inode(struct cyzfs_dentry* );
 struct cyzfs_inode* assemble_read_inode(struct cyzfs_dentry* );
-void assemble_sync_inode(struct cyzfs_inode * );
+int assemble_sync_inode(struct cyzfs_inode * );
+int assemble_sync_meta(void);
 char* assemble_get_fname(const char* ) ;
 int assemble_calc_lvl(const char * );
 struct cyzfs_dentry* assemble_find_dentry_of_path(const char * , int* , int* );
 char* assemble_alloc_datablk(int *);
+void assemble_free_datablk(int);
+char* assemble_get_page(struct cyzfs_inode*, int, int);
+int assemble_bmap(struct cyzfs_inode*, int, int);
+int assemble_bmap_truncate(struct cyzfs_inode*, int);
 int assemble_alloc_insert_dentry2inode(struct cyzfs_inode* , struct cyzfs_dentry* );
 struct cyzfs_dentry * assemble_get_dentry(struct cyzfs_inode* , int );
 
@@ -45,6 +58,8 @@ int   			   cyzfs_write(const char *, const char *, size_t, off_t,
 int   			   cyzfs_read(const char *, char *, size_t, off_t,
 					                 struct fuse_file_info *);
 int   			   cyzfs_access(const char *, int);
+int   			   cyzfs_fsync(const char *, int, struct fuse_file_info *);
+int   			   cyzfs_getxattr(const char *, const char *, char *, size_t);
 int   			   cyzfs_unlink(const char *);
 int   			   cyzfs_rmdir(const char *);
 int   			   cyzfs_rename(const char *, const char *);
@@ -4,14 +4,82 @@
 #include "ddriver_ctl_user.h"
 #include "stdio.h"
 
+#define DDRIVER_OPT_MMAP        0x1             /* 将整个磁盘镜像mmap进内存，读写变为memcpy */
+#define DDRIVER_OPT_SLEEP       0x2             /* 按设备模型计算的时间真实睡眠，否则只推进虚拟时钟 */
+#define DDRIVER_OPT_HEATMAP     0x4             /* 统计每个IO单位的读写次数，映射到镜像路径加_heat的文件 */
+#define DDRIVER_OPT_SPARSE      0x8             /* 稀疏镜像：仿qcow的两级映射，未写过的块读出全0，镜像随写入增长 */
+#define DDRIVER_OPT_ELIDE       0x10            /* 按IO单位记64位哈希，跳过内容与设备上相同的写 */
+
+#define DDRIVER_MODEL_NONE      0               /* 不模拟设备时间 */
+#define DDRIVER_MODEL_HDD       1               /* 7200转机械盘: 寻道、旋转等待、150MB/s */
+#define DDRIVER_MODEL_SSD       2               /* SATA固态盘: 请求开销、520MB/s */
+#define DDRIVER_MODEL_NVME      3               /* NVMe固态盘: 请求开销、3GB/s */
+
+#define DDRIVER_LOG_DEFAULT     0               /* 默认日志级别，即DDRIVER_LOG_INFO */
+#define DDRIVER_LOG_NONE        1               /* 不输出日志 */
+#define DDRIVER_LOG_ALERT       2               /* 只输出告警，重复告警限速 */
+#define DDRIVER_LOG_INFO        3               /* 告警与一般信息 */
+
+/**
+ * @brief ddriver_open_opts的打开选项
+ */
+struct ddriver_options
+{
+    int flags;                                  /* DDRIVER_OPT_开头的标志位 */
+    long long disk_size;                        /* 磁盘大小，0表示默认4MiB */
+    int iounit_size;                            /* IO单位，2的幂，0表示默认512B */
+    int queue_depth;                            /* 异步队列深度，0表示默认64 */
+    long long cache_size;                       /* 写回缓存字节数，0表示关闭，mmap模式下无效 */
+    int model;                                  /* DDRIVER_MODEL_开头的设备模型 */
+    long long bw_limit;                         /* 令牌桶带宽上限，字节/秒，0表示不限 */
+    const char *trace_path;                     /* 块IO trace环形文件，NULL表示不记录 */
+    long long trace_size;                       /* trace文件字节数，0表示默认16MiB */
+    int log_level;                              /* DDRIVER_LOG_开头的运行时日志级别 */
+};
+
+#define DDRIVER_OP_READ         0               /* ddriver_req.op: 读 */
+#define DDRIVER_OP_WRITE        1               /* ddriver_req.op: 写 */
+
 /**
- * @brief 打开ddriver设备
+ * @brief 异步请求，offset与size需与IO单位对齐，buf在完成前不可释放
+ */
+struct ddriver_req
+{
+    int    op;                                  /* DDRIVER_OP_READ / DDRIVER_OP_WRITE */
+    char  *buf;
+    size_t size;
+    off_t  offset;
+    void  *user_data;                           /* 原样带回ddriver_cpl */
+};
+
+/**
+ * @brief 异步完成项
+ */
+struct ddriver_cpl
+{
+    void  *user_data;
+    int    res;                                 /* 传输字节数，负数为-errno */
+};
+
+/**
+ * @brief 打开ddriver设备，每次打开都是独立的设备实例，
+ *        同一进程可同时打开多个镜像(如元数据盘与数据盘)
  * 
- * @param path ddriver设备路径
- * @return int 0成功，否则失败
+ * @param path 镜像文件路径，不存在则创建，日志写到path_log
+ * @return int 设备句柄，负数为失败
  */
 int ddriver_open(char *path);
 
+/**
+ * @brief 按选项打开ddriver设备，ddriver_open等价于从环境变量
+ *        DDRIVER_MMAP / DDRIVER_DISK_SZ / DDRIVER_IO_SZ 读取选项
+ * 
+ * @param path 镜像文件路径，不存在则创建
+ * @param opts 打开选项，NULL表示默认选项
+ * @return int 设备句柄，负数为失败
+ */
+int ddriver_open_opts(char *path, struct ddriver_options *opts);
+
 /**
  * @brief 移动ddriver磁盘头
  * 
@@ -42,6 +110,50 @@ int ddriver_write(int fd, char *buf, size_t size);
  */
 int ddriver_read(int fd, char *buf, size_t size);
 
+/**
+ * @brief 在指定偏移写入数据，不依赖ddriver_seek，可被多个线程同时调用
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的数据Buf
+ * @param size 要写入的数据大小，必须为设备IO单位的整数倍
+ * @param offset 写入位置，注意要和设备IO单位对齐
+ * @return int 写入字节数，负数表示失败
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 在指定偏移读出数据，不依赖ddriver_seek，可被多个线程同时调用
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要读出的数据Buf
+ * @param size 要读出的数据大小，必须为设备IO单位的整数倍
+ * @param offset 读出位置，注意要和设备IO单位对齐
+ * @return int 读出字节数，负数表示失败
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 连续读出多个IO单位，只产生一次设备请求
+ * 
+ * @param fd ddriver设备handler
+ * @param lba 起始IO单位号，即字节偏移 / 设备IO单位
+ * @param blks 要读出的IO单位个数
+ * @param buf 要读出的数据Buf，大小至少为 blks * 设备IO单位
+ * @return int 读出字节数，负数表示失败
+ */
+int ddriver_read_blocks(int fd, off_t lba, int blks, char *buf);
+
+/**
+ * @brief 连续写入多个IO单位，只产生一次设备请求
+ * 
+ * @param fd ddriver设备handler
+ * @param lba 起始IO单位号，即字节偏移 / 设备IO单位
+ * @param blks 要写入的IO单位个数
+ * @param buf 要写入的数据Buf，大小至少为 blks * 设备IO单位
+ * @return int 写入字节数，负数表示失败
+ */
+int ddriver_write_blocks(int fd, off_t lba, int blks, char *buf);
+
 /**
  * @brief ddriver IO控制
  * 
@@ -52,6 +164,47 @@ int ddriver_read(int fd, char *buf, size_t size);
  */
 int ddriver_ioctl(int fd, unsigned long cmd, void *ret);
 
+/**
+ * @brief mmap模式下获取某个IO单位的只读指针，无需拷贝
+ * 
+ * @param fd ddriver设备handler
+ * @param offset IO单位的偏移，注意要和设备IO单位对齐
+ * @return const char* 指向映射中的数据，非mmap模式返回NULL
+ */
+const char *ddriver_block_ptr(int fd, off_t offset);
+
+/**
+ * @brief 异步提交一批读写请求，不等待完成 (io_uring，不可用时退化为线程池)
+ * 
+ * @param fd ddriver设备handler
+ * @param reqs 请求数组
+ * @param n 请求个数
+ * @return int 实际提交个数，队列满时可能小于n；负数表示整批失败
+ */
+int ddriver_submit(int fd, struct ddriver_req *reqs, int n);
+
+/**
+ * @brief 收割已完成的异步请求
+ * 
+ * @param fd ddriver设备handler
+ * @param cpls 完成项数组
+ * @param max cpls容量
+ * @param timeout_ms 0立即返回，负数阻塞直到至少一个完成
+ * @return int 收割到的完成项个数
+ */
+int ddriver_reap(int fd, struct ddriver_cpl *cpls, int max, int timeout_ms);
+
+/**
+ * @brief 同步执行一批无序的读写请求：驱动按LBA排序，从当前磁头位置电梯式扫描(C-LOOK)，
+ *        相邻的同向请求合并为一次设备IO，全部完成后返回
+ * 
+ * @param fd ddriver设备handler
+ * @param reqs 请求数组，offset与size需与IO单位对齐，user_data不使用
+ * @param n 请求个数
+ * @return int 完成的请求数，负数表示失败
+ */
+int ddriver_submit_batch(int fd, struct ddriver_req *reqs, int n);
+
 /**
  * @brief 关闭ddriver设备
  * 
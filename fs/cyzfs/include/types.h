@@ -13,14 +13,28 @@ typedef enum cyzfs_file_type {
     TYPE_DIR             // directory file
 } CYZFS_FILE_TYPE;
 
+typedef enum cyzfs_io_tag {     // IOC_REQ_DEVICE_TAG，按元数据类型统计设备IO
+    TAG_OTHER,
+    TAG_SUPER,           // super block
+    TAG_BITMAP,          // inode / data bitmap
+    TAG_INODE,           // inode table
+    TAG_DENTRY,          // directory entries
+    TAG_DATA             // file data
+} CYZFS_IO_TAG;
+
 #define TRUE                    1
 #define FALSE                   0
 #define DISK_SIZE               (4*1024*1024)   // ddrive capacity = 4MiB
 #define FS_BLOCK_SIZE           1024            // EXT2 BLOCK SIZE = 1KiB
 #define MAX_INODE               (4*1024)
-#define IO_SIZE                 512
+#define IO_SIZE                 (super.sz_io)   // 由驱动IOC_REQ_DEVICE_IO_SZ决定，默认512B
 #define MAX_NAME_LEN            128     
 #define ROOT_INODE_NUM          0               // 根据指导书，EXT2文件系统根目录的索引号为2
+#define CYZFS_PTRS_PER_BLK      (FS_BLOCK_SIZE / (int)sizeof(int))  // 间接块中的指针数
+#define CYZFS_MAX_BLKS          (6 + CYZFS_PTRS_PER_BLK + CYZFS_PTRS_PER_BLK * CYZFS_PTRS_PER_BLK)
+#define BCACHE_NBUF             256             // 块缓存容量，单位BCACHE_BLK_SZ
+#define BCACHE_NHASH            64
+#define BCACHE_BLK_SZ           (IO_SIZE > FS_BLOCK_SIZE ? IO_SIZE : FS_BLOCK_SIZE)
 #define BLK_ROUND_DOWN(value, round)    (value % round == 0 ? value : (value / round) * round)
 #define BLK_ROUND_UP(value, round)      (value % round == 0 ? value : (value / round + 1) * round)
 
@@ -47,6 +61,8 @@ struct cyzfs_inode_d {
     CYZFS_FILE_TYPE    ftype;              // 文件类型（目录类型、普通文件类型）
     int                dir_cnt;            // 如果是目录类型文件，下面有几个目录项
     int                data_pointer[6];   // 数据块指针（可固定分配） 
+    int                indirect;          // 一次间接块，-1为无
+    int                dindirect;         // 二次间接块，-1为无
 };
 
 struct cyzfs_dentry_d {
@@ -59,6 +75,23 @@ struct cyzfs_dentry_d {
 /******************************************************************************
 * SECTION: FS Specific Structure - In memory structure
 *******************************************************************************/
+struct cyzfs_part {                      // assemble_commit的一段，不必与IO单位对齐
+    int      offset;
+    char*    buf;
+    int      size;
+};
+
+struct cyzfs_buf {                       // 块缓存中的一块，assemble_bget取得、assemble_brelse归还
+    int                 blkno;                      // 以BCACHE_BLK_SZ为单位，-1为空
+    int                 dirty;
+    int                 pin;                        // 非0时不会被换出
+    CYZFS_IO_TAG        tag;                        // 弄脏它的IO类别，写回时沿用
+    char*               data;
+    struct cyzfs_buf*   hnext;                      // 哈希链
+    struct cyzfs_buf*   prev;                       // LRU链，super.lru.next为最近使用
+    struct cyzfs_buf*   next;
+};
+
 struct cyzfs_super ;
 struct cyzfs_inode;
 struct cyzfs_dentry;
@@ -66,6 +99,7 @@ struct cyzfs_dentry;
 struct cyzfs_super {
     int                 fd;
     int                 sz_usage;
+    int                 sz_io;                          // 驱动IO单位
 
     char*            bitmap_inode_ptr;               // inode位图in memory
     char*            bitmap_data_ptr;                // data位图in memory
@@ -81,6 +115,14 @@ struct cyzfs_super {
     int                 inode_offset;
     int                 data_blks;
     int                 data_offset;
+
+    struct cyzfs_buf*   bufs;                       // 块缓存，BCACHE_NBUF块
+    struct cyzfs_buf*   bhash[BCACHE_NHASH];
+    struct cyzfs_buf    lru;                        // LRU链表头
+    CYZFS_IO_TAG        tag;                        // assemble_tag当前的类别
+    unsigned long       bcache_hits;
+    unsigned long       bcache_misses;
+    unsigned long       bcache_writebacks;          // 写回设备的块数
 };
 
 
@@ -93,7 +135,11 @@ struct cyzfs_inode {
     struct cyzfs_dentry*      dentry_parent;        // 指向该inode的dentry
     struct cyzfs_dentry*      dentry_children;      // 所有子目录项  
     int                 data_pointer[6];        // 数据块指针
-    char*               data_pointer_mem[6];    //数据块在内存中的指针
+    int                 indirect;               // 一次间接块，-1为无
+    int                 dindirect;              // 二次间接块，-1为无
+    char**              data_pointer_mem;       //第i个文件块在内存中的页，NULL为未装入，按需扩展到mem_cnt项
+    char*               data_dirty;             //data_pointer_mem[i]改过，待写回
+    int                 mem_cnt;
 };
 
 
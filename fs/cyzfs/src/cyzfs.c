@@ -25,68 +25,275 @@ static struct fuse_operations operations = {
 	.getattr = cyzfs_getattr,				 /* 获取文件属性，类似stat，必须完成 */
 	.readdir = cyzfs_readdir,				 /* 填充dentrys */
 	.mknod = cyzfs_mknod,					 /* 创建文件，touch相关 */
-	.write = NULL,								  	 /* 写入文件 */
-	.read = NULL,								  	 /* 读文件 */
+	.write = cyzfs_write,					 /* 写入文件 */
+	.read = cyzfs_read,						 /* 读文件 */
 	.utimens = cyzfs_utimens,				 /* 修改时间，忽略，避免touch报错 */
-	.truncate = NULL,						  		 /* 改变文件大小 */
+	.truncate = cyzfs_truncate,				 /* 改变文件大小 */
 	.unlink = NULL,							  		 /* 删除文件 */
 	.rmdir	= NULL,							  		 /* 删除目录， rm -r */
 	.rename = NULL,							  		 /* 重命名，mv */
 
 	.open = NULL,							
 	.opendir = NULL,
-	.access = NULL
+	.access = NULL,
+	.fsync = cyzfs_fsync,					 /* 写回文件并落盘 */
+	.getxattr = cyzfs_getxattr				 /* 挂载期间读块缓存统计，getfattr */
 };
 
+/******************************************************************************
+* SECTION: 块缓存
+*******************************************************************************/
+static void bcache_lru_del(struct cyzfs_buf* b) {
+	b->prev->next = b->next;
+	b->next->prev = b->prev;
+}
+
+static void bcache_lru_add(struct cyzfs_buf* b) {
+	//放到表头，即最近使用
+	b->next = super.lru.next;
+	b->prev = &super.lru;
+	super.lru.next->prev = b;
+	super.lru.next = b;
+}
+
+static void bcache_hash_del(struct cyzfs_buf* b) {
+	struct cyzfs_buf** pp = &super.bhash[b->blkno % BCACHE_NHASH];
+	while (*pp != b)
+		pp = &(*pp)->hnext;
+	*pp = b->hnext;
+}
+
+static int bcache_writeback(struct cyzfs_buf* b) {
+	//按弄脏它的类别计入IOC_REQ_DEVICE_TAG的统计
+	CYZFS_IO_TAG tag = super.tag;
+	int ret;
+	assemble_tag(b->tag);
+	ret = ddriver_write_blocks(super.fd, (off_t)b->blkno * (BCACHE_BLK_SZ / IO_SIZE), BCACHE_BLK_SZ / IO_SIZE, b->data);
+	assemble_tag(tag);
+	if (ret < 0)
+		return ret;					//写失败仍是脏块，下次换出或assemble_flush再写
+	b->dirty = FALSE;
+	super.bcache_writebacks++;
+	return 0;
+}
+
+void assemble_bcache_init(void) {
+	//建立BCACHE_NBUF块的空缓存，须在取得IO单位之后
+	int i;
+	super.bufs = (struct cyzfs_buf*)calloc(BCACHE_NBUF, sizeof(struct cyzfs_buf));
+	memset(super.bhash, 0, sizeof(super.bhash));
+	super.lru.next = super.lru.prev = &super.lru;
+	for (i = 0; i < BCACHE_NBUF; i++) {
+		super.bufs[i].blkno = -1;
+		super.bufs[i].data = (char*)malloc(BCACHE_BLK_SZ);
+		bcache_lru_add(&super.bufs[i]);
+	}
+	super.bcache_hits = super.bcache_misses = super.bcache_writebacks = 0;
+}
+
+void assemble_bcache_free(void) {
+	//先assemble_flush，这里丢弃所有块
+	int i;
+	printf("bcache: %lu hits, %lu misses, %lu writebacks\n",
+		   super.bcache_hits, super.bcache_misses, super.bcache_writebacks);
+	for (i = 0; i < BCACHE_NBUF; i++)
+		free(super.bufs[i].data);
+	free(super.bufs);
+	super.bufs = NULL;
+}
+
+struct cyzfs_buf* assemble_bget(int blkno, int fill) {
+	//取得第blkno块并钉住，用完须assemble_brelse
+	//未命中时换出最久未用且未钉住的块(脏则先写回)，fill为FALSE表示调用者将覆盖整块，不必读设备
+	//写回或读入失败时返回NULL，缓存中不留下读坏的块
+	struct cyzfs_buf* b;
+	for (b = super.bhash[blkno % BCACHE_NHASH]; b != NULL; b = b->hnext) {
+		if (b->blkno == blkno) {
+			super.bcache_hits++;
+			goto found;
+		}
+	}
+	super.bcache_misses++;
+	for (b = super.lru.prev; b != &super.lru && b->pin; b = b->prev)
+		;
+	if (b == &super.lru) {
+		printf("bcache: all blocks pinned!\n");
+		return NULL;
+	}
+	if (b->dirty && bcache_writeback(b) < 0) {
+		printf("bcache: writeback of block %d failed\n", b->blkno);
+		return NULL;
+	}
+	if (b->blkno != -1)
+		bcache_hash_del(b);
+	b->blkno = -1;
+	if (fill && ddriver_read_blocks(super.fd, (off_t)blkno * (BCACHE_BLK_SZ / IO_SIZE), BCACHE_BLK_SZ / IO_SIZE, b->data) < 0) {
+		printf("bcache: read of block %d failed\n", blkno);
+		return NULL;
+	}
+	b->blkno = blkno;
+	b->hnext = super.bhash[blkno % BCACHE_NHASH];
+	super.bhash[blkno % BCACHE_NHASH] = b;
+found:
+	bcache_lru_del(b);
+	bcache_lru_add(b);
+	b->pin++;
+	return b;
+}
+
+void assemble_brelse(struct cyzfs_buf* b, int dirty) {
+	//归还assemble_bget取得的块，dirty表示改过内容，在换出或assemble_flush时写回
+	if (dirty) {
+		b->dirty = TRUE;
+		b->tag = super.tag;
+	}
+	b->pin--;
+}
+
+int assemble_flush(void) {
+	//写回所有脏块：每个类别一批交给驱动，由驱动按LBA排序合并成近似顺序的一趟扫描
+	//批量失败时逐块重写，只有写成功的块才变干净，返回最后一个失败的错误码
+	struct ddriver_req* reqs = (struct ddriver_req*)malloc(BCACHE_NBUF * sizeof(struct ddriver_req));
+	CYZFS_IO_TAG tag, cur = super.tag;
+	int i, n, err, ret = 0;
+
+	if (reqs == NULL)
+		return -ENOMEM;
+	for (tag = TAG_OTHER; tag <= TAG_DATA; tag++) {
+		for (i = 0, n = 0; i < BCACHE_NBUF; i++) {
+			struct cyzfs_buf* b = &super.bufs[i];
+			if (!b->dirty || b->tag != tag)
+				continue;
+			reqs[n].op = DDRIVER_OP_WRITE;
+			reqs[n].buf = b->data;
+			reqs[n].size = BCACHE_BLK_SZ;
+			reqs[n].offset = (off_t)b->blkno * BCACHE_BLK_SZ;
+			reqs[n].user_data = b;
+			n++;
+		}
+		if (n == 0)
+			continue;
+		assemble_tag(tag);
+		if (ddriver_submit_batch(super.fd, reqs, n) < 0) {
+			for (i = 0; i < n; i++) {
+				err = ddriver_write_blocks(super.fd, reqs[i].offset / IO_SIZE, BCACHE_BLK_SZ / IO_SIZE, reqs[i].buf);
+				if (err < 0) {
+					ret = err;
+					continue;
+				}
+				((struct cyzfs_buf*)reqs[i].user_data)->dirty = FALSE;
+				super.bcache_writebacks++;
+			}
+			continue;
+		}
+		for (i = 0; i < n; i++)
+			((struct cyzfs_buf*)reqs[i].user_data)->dirty = FALSE;
+		super.bcache_writebacks += n;
+	}
+	assemble_tag(cur);
+	free(reqs);
+	return ret;
+}
+
+static void bcache_update(int offset, char *buf, int size) {
+	//设备上[offset, offset + size)已被别的途径写成buf，只更新缓存中已有的块，不改变脏与否
+	struct cyzfs_buf* b;
+	int blk, lo, hi;
+	for (blk = offset / BCACHE_BLK_SZ; blk * BCACHE_BLK_SZ < offset + size; blk++) {
+		for (b = super.bhash[blk % BCACHE_NHASH]; b != NULL && b->blkno != blk; b = b->hnext)
+			;
+		if (b == NULL)
+			continue;
+		lo = blk * BCACHE_BLK_SZ > offset ? blk * BCACHE_BLK_SZ : offset;
+		hi = (blk + 1) * BCACHE_BLK_SZ < offset + size ? (blk + 1) * BCACHE_BLK_SZ : offset + size;
+		memcpy(b->data + (lo - blk * BCACHE_BLK_SZ), buf + (lo - offset), hi - lo);
+	}
+}
 /******************************************************************************
 * SECTION: Assemble Function for disk operation for cyzfs	reference to sfs_utils.c
 *******************************************************************************/
 
 int assemble_read(int offset, char *buf, int size) {
 	//从offset开始，读size个字节，存入buf
-	//实现集成的辅助512字节对齐
-    int      offset_aligned = BLK_ROUND_DOWN(offset, IO_SIZE);
-    int      bias           = offset - offset_aligned;
-    int      size_aligned   = BLK_ROUND_UP((size + bias), IO_SIZE);
-    char* temp_content   = (char*)malloc(size_aligned);
-    char* cur            = temp_content;
-
-    ddriver_seek(super.fd, offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        ddriver_read(super.fd, cur, IO_SIZE);
-        cur          += IO_SIZE;
-        size_aligned -= IO_SIZE;   
-    }
-    memcpy(buf, temp_content + bias, size);		//读最初要求的数据，不含对齐
-    free(temp_content);
+	//经过块缓存，不必与IO单位对齐
+	struct cyzfs_buf* b;
+	int blk, lo, hi;
+	for (blk = offset / BCACHE_BLK_SZ; blk * BCACHE_BLK_SZ < offset + size; blk++) {
+		if ((b = assemble_bget(blk, TRUE)) == NULL)
+			return -EIO;
+		lo = blk * BCACHE_BLK_SZ > offset ? blk * BCACHE_BLK_SZ : offset;
+		hi = (blk + 1) * BCACHE_BLK_SZ < offset + size ? (blk + 1) * BCACHE_BLK_SZ : offset + size;
+		memcpy(buf + (lo - offset), b->data + (lo - blk * BCACHE_BLK_SZ), hi - lo);
+		assemble_brelse(b, FALSE);
+	}
     return 0;
 }
 
 int assemble_write(int offset, char *buf, int size) {
 	//将buf的size字节写入offset开始的磁盘块中
-	//因为原始写需要512整个写，故需要提前将非对齐部分读入内存并整合写入
-    int      offset_aligned = BLK_ROUND_DOWN(offset, IO_SIZE);
-    int      bias           = offset - offset_aligned;
-    int      size_aligned   = BLK_ROUND_UP((size + bias), IO_SIZE);
-    char* temp_content   = (char*)malloc(size_aligned);
-    char* cur            = temp_content;
-    assemble_read(offset_aligned, temp_content, size_aligned);	//补齐非对齐部分
-    memcpy(temp_content + bias, buf, size);
-    
-    ddriver_seek(super.fd, offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        ddriver_write(super.fd, cur, IO_SIZE);
-        cur          += IO_SIZE;
-        size_aligned -= IO_SIZE;   
-    }
-
-    free(temp_content);
-	printf("----write successful\n");
+	//只改块缓存，换出或assemble_flush时写回；部分覆盖的块先读入，整块覆盖的不读
+	struct cyzfs_buf* b;
+	int blk, lo, hi;
+	for (blk = offset / BCACHE_BLK_SZ; blk * BCACHE_BLK_SZ < offset + size; blk++) {
+		lo = blk * BCACHE_BLK_SZ > offset ? blk * BCACHE_BLK_SZ : offset;
+		hi = (blk + 1) * BCACHE_BLK_SZ < offset + size ? (blk + 1) * BCACHE_BLK_SZ : offset + size;
+		if ((b = assemble_bget(blk, hi - lo != BCACHE_BLK_SZ)) == NULL)
+			return -EIO;
+		memcpy(b->data + (lo - blk * BCACHE_BLK_SZ), buf + (lo - offset), hi - lo);
+		assemble_brelse(b, TRUE);
+	}
     return 0;
 }
 
+void assemble_tag(CYZFS_IO_TAG tag) {
+	//之后本线程的设备IO计入该tag，见IOC_REQ_DEVICE_TAG
+	int t = tag;
+	super.tag = tag;
+	ddriver_ioctl(super.fd, IOC_REQ_DEVICE_TAG, &t);
+}
+
+int assemble_commit(struct cyzfs_part* parts, int n) {
+	//将n段数据一次写入：全部写入或全部不写，崩溃后不会只剩一半
+	//按IO单位拼好(非对齐部分取自块缓存)后走IOC_REQ_DEVICE_ATOMIC_WRITE，再更新块缓存，
+	//驱动不支持或超过DDRIVER_ATOMIC_MAX个IO单位时退化为逐段写并assemble_flush
+	struct ddriver_atomic_vec vecs[DDRIVER_ATOMIC_MAX];
+	struct ddriver_atomic_write aw = { 0, vecs };
+	int i, j, off, lo, hi, ret = -1;
+
+	for (i = 0; i < n; i++) {
+		for (off = BLK_ROUND_DOWN(parts[i].offset, IO_SIZE); off < parts[i].offset + parts[i].size; off += IO_SIZE) {
+			for (j = 0; j < aw.count && vecs[j].offset != off; j++)
+				;
+			if (j == aw.count) {
+				if (aw.count == DDRIVER_ATOMIC_MAX)
+					goto out;
+				vecs[j].offset = off;
+				if ((vecs[j].buf = (char*)malloc(IO_SIZE)) == NULL)
+					goto out;
+				aw.count++;
+				if (assemble_read(off, vecs[j].buf, IO_SIZE) < 0)
+					goto out;
+			}
+			lo = off > parts[i].offset ? off : parts[i].offset;
+			hi = off + IO_SIZE < parts[i].offset + parts[i].size ? off + IO_SIZE : parts[i].offset + parts[i].size;
+			memcpy(vecs[j].buf + (lo - off), parts[i].buf + (lo - parts[i].offset), hi - lo);
+		}
+	}
+	ret = ddriver_ioctl(super.fd, IOC_REQ_DEVICE_ATOMIC_WRITE, &aw);
+out:
+	for (j = 0; j < aw.count; j++)
+		free(vecs[j].buf);
+	for (i = 0; i < n; i++) {
+		if (ret >= 0)
+			bcache_update(parts[i].offset, parts[i].buf, parts[i].size);
+		else if (assemble_write(parts[i].offset, parts[i].buf, parts[i].size) < 0)
+			return -EIO;
+	}
+	if (ret < 0)
+		return assemble_flush();
+	return 0;
+}
+
 struct cyzfs_dentry* assemble_new_dentry(char * fname, CYZFS_FILE_TYPE ftype){
 	//在内存中新建一个dentry
 	struct cyzfs_dentry* new_dentry = (struct cyzfs_dentry*)malloc(sizeof(struct cyzfs_dentry));
@@ -103,7 +310,7 @@ struct cyzfs_dentry* assemble_new_dentry(char * fname, CYZFS_FILE_TYPE ftype){
 
 struct cyzfs_inode* assemble_alloc_inode(struct cyzfs_dentry* dentry){
 	// 新分配一个inode，分配的inode需要在inode位图中对应为0，注意inode未同步至磁盘
-	super.bitmap_inode_ptr[0] |= (1 << ROOT_INODE_NUM);
+	// 格式化时位图全0，第一个分配的就是根目录，正好得到ROOT_INODE_NUM
 	int free_ino = -1;
 	int inode_num,byte,bit;
 	for(inode_num = 0; inode_num < MAX_INODE; inode_num++){
@@ -134,8 +341,12 @@ struct cyzfs_inode* assemble_alloc_inode(struct cyzfs_dentry* dentry){
 	new_inode->dentry_children = NULL;
 	for(int i=0; i<6; i++){
 		new_inode->data_pointer[i] = -1;
-		new_inode->data_pointer_mem[i] = NULL;
 	}
+	new_inode->indirect = -1;
+	new_inode->dindirect = -1;
+	new_inode->data_pointer_mem = NULL;
+	new_inode->data_dirty = NULL;
+	new_inode->mem_cnt = 0;
 	return new_inode;
 }
 
@@ -146,6 +357,7 @@ struct cyzfs_inode* assemble_read_inode(struct cyzfs_dentry* dentry){
     struct cyzfs_dentry_d dentry_d;
 	int i;
 	//Q:为什么sfs每个inode占用一个Blk啊，好浪费，这里改了不同于sfs
+	assemble_tag(TAG_INODE);
 	assemble_read((super.inode_offset * FS_BLOCK_SIZE + dentry->ino * sizeof(struct cyzfs_inode_d)), 
 					(char*)&inode_d, 
 					sizeof(struct cyzfs_inode_d));/***sb error***/
@@ -158,15 +370,13 @@ struct cyzfs_inode* assemble_read_inode(struct cyzfs_dentry* dentry){
 	dentry->inode = inode;
 	for(i=0; i<6; i++){
 		inode->data_pointer[i] = inode_d.data_pointer[i];
-		// malloc data pointer in memory
-		// Q:这里是每次把inode读入mem时，就把其对应的数据块都都装入内存，有待商榷
-		if(inode_d.data_pointer[i] != -1){
-			inode->data_pointer_mem[i] = (char*)malloc(FS_BLOCK_SIZE);
-			assemble_read((super.data_offset + inode->data_pointer[i]) * FS_BLOCK_SIZE, 
-							inode->data_pointer_mem[i], 
-							FS_BLOCK_SIZE);
-		}
 	}
+	inode->indirect = inode_d.indirect;
+	inode->dindirect = inode_d.dindirect;
+	// 数据块在第一次读写时才由assemble_get_page装入内存
+	inode->data_pointer_mem = NULL;
+	inode->data_dirty = NULL;
+	inode->mem_cnt = 0;
 	if(inode->dentry_parent->ftype == TYPE_DIR){
 		// DIR should init inode->dentry_children
 		// read in (data)dentry block
@@ -177,7 +387,8 @@ struct cyzfs_inode* assemble_read_inode(struct cyzfs_dentry* dentry){
 			int j = i / dentry_per_datablock;		//i dentry 在第j个数据块中
 			int k = i % dentry_per_datablock;		//块内序号
 			// 将第i个目录项读到dentry_d中
-			assemble_read(((super.data_offset + inode->data_pointer[j]) * FS_BLOCK_SIZE + k * sizeof(struct cyzfs_dentry_d)),
+			assemble_tag(TAG_DENTRY);
+			assemble_read(((super.data_offset + assemble_bmap(inode, j, FALSE)) * FS_BLOCK_SIZE + k * sizeof(struct cyzfs_dentry_d)),
 							(char *)&dentry_d,
 							sizeof(struct cyzfs_dentry_d));
 			// 建立对应的内存中的目录项，插入inode链表
@@ -193,13 +404,15 @@ struct cyzfs_inode* assemble_read_inode(struct cyzfs_dentry* dentry){
 	return inode;
 }
 
-void assemble_sync_inode(struct cyzfs_inode * inode){
+int assemble_sync_inode(struct cyzfs_inode * inode){
 	printf("---start sync inode %s--\n", inode->dentry_parent->name);
 	/************** 将inode对应内容递归的全部写回磁盘 ***************/
+	/************** 出错时继续写其余部分，返回-EIO，写失败的页仍是脏页 ***************/
 	struct cyzfs_inode_d inode_d;
 	struct cyzfs_dentry* dentry;
 	struct cyzfs_dentry_d dentry_d;
 	int ino = inode->ino;
+	int ret = 0;
 
 	/******************** 写回inode *********************/
 	inode_d.ino = inode->ino;
@@ -209,9 +422,14 @@ void assemble_sync_inode(struct cyzfs_inode * inode){
 	for(int i=0; i < 6; i++){
 		inode_d.data_pointer[i] = inode->data_pointer[i];
 	}
-	assemble_write((super.inode_offset * FS_BLOCK_SIZE + ino * sizeof(struct cyzfs_inode_d)), 
+	inode_d.indirect = inode->indirect;
+	inode_d.dindirect = inode->dindirect;
+	assemble_tag(TAG_INODE);
+	if(assemble_write((super.inode_offset * FS_BLOCK_SIZE + ino * sizeof(struct cyzfs_inode_d)), 
 					(char*)&inode_d, 
-					sizeof(struct cyzfs_inode_d));
+					sizeof(struct cyzfs_inode_d)) < 0){
+		ret = -EIO;
+	}
 	
 
 	/************************* 写回inode对应的data***************************/
@@ -226,16 +444,19 @@ void assemble_sync_inode(struct cyzfs_inode * inode){
 		{
 			int j = cnt / dentry_per_datablock;
 			int k = cnt % dentry_per_datablock;
-			int offset = (super.data_offset + inode->data_pointer[j]) * FS_BLOCK_SIZE + k * sizeof(struct cyzfs_dentry_d);
+			int offset = (super.data_offset + assemble_bmap(inode, j, FALSE)) * FS_BLOCK_SIZE + k * sizeof(struct cyzfs_dentry_d);
 			cnt++;
 			memset(dentry_d.name, 0, MAX_NAME_LEN);
 			memcpy(dentry_d.name, dentry->name, strlen(dentry->name));
 			dentry_d.ino = dentry->ino;
 			dentry_d.ftype = dentry->ftype;
 			// printf("sync inode %s\n",dentry->name);
-			assemble_write(offset, (char *)&dentry_d, sizeof(struct cyzfs_dentry_d));
-			if(dentry->inode != NULL){
-				assemble_sync_inode(dentry->inode);
+			assemble_tag(TAG_DENTRY);
+			if(assemble_write(offset, (char *)&dentry_d, sizeof(struct cyzfs_dentry_d)) < 0){
+				ret = -EIO;
+			}
+			if(dentry->inode != NULL && assemble_sync_inode(dentry->inode) < 0){
+				ret = -EIO;
 			}
 			dentry = dentry->brother;
 			// offset += sizeof(struct cyzfs_dentry_d);
@@ -252,23 +473,44 @@ void assemble_sync_inode(struct cyzfs_inode * inode){
 		// if(inode->data_pointer[0] != -1){
 		// 	assemble_write((super.data_offset + inode->data_pointer[0])*FS_BLOCK_SIZE, inode->data_pointer_mem[0], FS_BLOCK_SIZE);
 		// }
-		for(int i=0;i<6;i++){
-			int flag = 0;
-			for(int j=0;j<i;j++){
-				if(inode->data_pointer[i]==inode->data_pointer[j]){
-					flag = 1;
-					break;
-				}
-			}
-			if(flag == 0){
-				if(inode->data_pointer[i] != -1){
-					assemble_write((super.data_offset + inode->data_pointer[i])*FS_BLOCK_SIZE, inode->data_pointer_mem[i], FS_BLOCK_SIZE);
+		/****** 只写回cyzfs_write改过的块，没装入内存的块磁盘上就是最新的 *******/
+		for(int i=0;i<inode->mem_cnt;i++){
+			if(inode->data_dirty[i]){
+				assemble_tag(TAG_DATA);
+				if(assemble_write((super.data_offset + assemble_bmap(inode, i, FALSE))*FS_BLOCK_SIZE, inode->data_pointer_mem[i], FS_BLOCK_SIZE) < 0){
+					ret = -EIO;
+					continue;
 				}
+				inode->data_dirty[i] = FALSE;
 			}
 		}
 	}
 	printf("end sync inode\n");
-	// return 0;
+	return ret;
+}
+
+int assemble_sync_meta(void) {
+	/******************* 两个位图与超级块一起提交 *************************/
+	struct cyzfs_super_d super_d;
+	struct cyzfs_part parts[3];
+
+	super_d.magic = CYZFS_MAGIC;
+	super_d.sz_usage = super.sz_usage;
+	super_d.bitmap_inode_blks = super.bitmap_inode_blks;
+	super_d.bitmap_inode_offset = super.bitmap_inode_offset;
+	super_d.bitmap_data_blks = super.bitmap_data_blks;
+	super_d.bitmap_data_offset = super.bitmap_data_offset;
+	parts[0].offset = super.bitmap_inode_offset * FS_BLOCK_SIZE;
+	parts[0].buf = super.bitmap_inode_ptr;
+	parts[0].size = super.bitmap_inode_blks * FS_BLOCK_SIZE;
+	parts[1].offset = super.bitmap_data_offset * FS_BLOCK_SIZE;
+	parts[1].buf = super.bitmap_data_ptr;
+	parts[1].size = super.bitmap_data_blks * FS_BLOCK_SIZE;
+	parts[2].offset = 0;
+	parts[2].buf = (char *)&super_d;
+	parts[2].size = sizeof(struct cyzfs_super_d);
+	assemble_tag(TAG_SUPER);
+	return assemble_commit(parts, 3);
 }
 
 
@@ -368,23 +610,186 @@ struct cyzfs_dentry* assemble_find_dentry_of_path(const char * path, int* is_fin
     return dentry_ret;
 }
 
-char* assemble_alloc_datablk(int *datablk_no){
-	/***** refer to assemble_alloc_inode(bitmap!) *****/
+static int datablk_take(void){
+	/***** refer to assemble_alloc_inode(bitmap!)，没有空闲块返回-1 *****/
 	int dbno,bit,byte;
-	for(dbno=0; dbno<MAX_INODE; dbno++){
+	for(dbno=0; dbno<super.data_blks; dbno++){
 		byte = dbno / 8;
 		bit = dbno % 8;
 		if(((super.bitmap_data_ptr[byte] >> bit) & 1) == 0){
 			// no.i inode is free
-			*datablk_no = dbno;
 			super.bitmap_data_ptr[byte] |= (1 << bit);
-			break;
+			return dbno;
 		}
 	}
+	return -1;
+}
+
+char* assemble_alloc_datablk(int *datablk_no){
+	*datablk_no = datablk_take();
 	char* datablk_ptr = (char*)malloc(FS_BLOCK_SIZE);
 	return datablk_ptr;
 }
 
+static int bmap_slot(int ptrblk, int idx, int alloc, int is_map){
+	/******* 间接块ptrblk的第idx项，经块缓存读写。项为-1且alloc时分配一块填入 ********/
+	/******* is_map: 新块本身也是间接块，所有项置为-1 ********/
+	/******* 间接块的IO计入TAG_INODE，返回前恢复调用者的tag ********/
+	/******* 读写间接块失败返回-1，新分配的块还回位图 ********/
+	int off = (super.data_offset + ptrblk) * FS_BLOCK_SIZE + idx * sizeof(int);
+	int dbno = -1;
+	CYZFS_IO_TAG tag = super.tag;
+	assemble_tag(TAG_INODE);
+	if(assemble_read(off, (char*)&dbno, sizeof(int)) < 0){
+		dbno = -1;
+	}
+	else if(dbno == -1 && alloc && (dbno = datablk_take()) != -1){
+		int ptrs[CYZFS_PTRS_PER_BLK];
+		memset(ptrs, 0xff, sizeof(ptrs));
+		if((is_map && assemble_write((super.data_offset + dbno) * FS_BLOCK_SIZE, (char*)ptrs, FS_BLOCK_SIZE) < 0) ||
+		   assemble_write(off, (char*)&dbno, sizeof(int)) < 0){
+			assemble_free_datablk(dbno);
+			dbno = -1;
+		}
+	}
+	assemble_tag(tag);
+	return dbno;
+}
+
+static int bmap_root(int* ptrblk, int alloc){
+	/******* inode中的间接块指针，-1且alloc时分配一个全-1的间接块 ********/
+	int ptrs[CYZFS_PTRS_PER_BLK];
+	CYZFS_IO_TAG tag = super.tag;
+	if(*ptrblk == -1 && alloc && (*ptrblk = datablk_take()) != -1){
+		memset(ptrs, 0xff, sizeof(ptrs));
+		assemble_tag(TAG_INODE);
+		if(assemble_write((super.data_offset + *ptrblk) * FS_BLOCK_SIZE, (char*)ptrs, FS_BLOCK_SIZE) < 0){
+			assemble_free_datablk(*ptrblk);
+			*ptrblk = -1;
+		}
+		assemble_tag(tag);
+	}
+	return *ptrblk;
+}
+
+int assemble_bmap(struct cyzfs_inode* inode, int blk, int alloc){
+	/******* 文件第blk块对应的数据块号，ext2式: 6个直接块、一次间接、二次间接 ********/
+	/******* 间接块经块缓存读取，最多两级；没有对应块返回-1，alloc为TRUE则分配 ********/
+	int ind;
+	if(blk < 0 || blk >= CYZFS_MAX_BLKS){
+		return -1;
+	}
+	if(blk < 6){
+		if(inode->data_pointer[blk] == -1 && alloc){
+			inode->data_pointer[blk] = datablk_take();
+		}
+		return inode->data_pointer[blk];
+	}
+	blk -= 6;
+	if(blk < CYZFS_PTRS_PER_BLK){
+		if(bmap_root(&inode->indirect, alloc) == -1){
+			return -1;
+		}
+		return bmap_slot(inode->indirect, blk, alloc, FALSE);
+	}
+	blk -= CYZFS_PTRS_PER_BLK;
+	if(bmap_root(&inode->dindirect, alloc) == -1){
+		return -1;
+	}
+	if((ind = bmap_slot(inode->dindirect, blk / CYZFS_PTRS_PER_BLK, alloc, TRUE)) == -1){
+		return -1;
+	}
+	return bmap_slot(ind, blk % CYZFS_PTRS_PER_BLK, alloc, FALSE);
+}
+
+static int bmap_free_range(int ptrblk, int from){
+	/******* 释放间接块ptrblk中第from项起的数据块 ********/
+	/******* 改过的间接块写回成功后才释放位图，失败返回-EIO且什么都不释放 ********/
+	int ptrs[CYZFS_PTRS_PER_BLK], old[CYZFS_PTRS_PER_BLK];
+	int i, ret = -EIO;
+	CYZFS_IO_TAG tag = super.tag;
+	assemble_tag(TAG_INODE);
+	if(assemble_read((super.data_offset + ptrblk) * FS_BLOCK_SIZE, (char*)ptrs, FS_BLOCK_SIZE) < 0){
+		goto out;
+	}
+	memcpy(old, ptrs, sizeof(ptrs));
+	for(i = from < 0 ? 0 : from; i < CYZFS_PTRS_PER_BLK; i++){
+		ptrs[i] = -1;
+	}
+	if(assemble_write((super.data_offset + ptrblk) * FS_BLOCK_SIZE, (char*)ptrs, FS_BLOCK_SIZE) < 0){
+		goto out;
+	}
+	for(i = from < 0 ? 0 : from; i < CYZFS_PTRS_PER_BLK; i++){
+		if(old[i] != -1){
+			assemble_free_datablk(old[i]);
+		}
+	}
+	ret = 0;
+out:
+	assemble_tag(tag);
+	return ret;
+}
+
+int assemble_bmap_truncate(struct cyzfs_inode* inode, int keep){
+	/******* 只保留文件前keep块，释放其后的数据块与不再需要的间接块 ********/
+	/******* 读写间接块失败返回-EIO，已释放的部分保持一致，未释放的仍挂在inode上 ********/
+	int ptrs[CYZFS_PTRS_PER_BLK], old[CYZFS_PTRS_PER_BLK];
+	int i, first, ret = 0;
+	CYZFS_IO_TAG tag = super.tag;
+	for(i = keep; i < 6; i++){
+		if(inode->data_pointer[i] != -1){
+			assemble_free_datablk(inode->data_pointer[i]);
+			inode->data_pointer[i] = -1;
+		}
+	}
+	if(inode->indirect != -1 && keep < 6 + CYZFS_PTRS_PER_BLK){
+		if(bmap_free_range(inode->indirect, keep - 6) < 0){
+			return -EIO;
+		}
+		if(keep <= 6){
+			assemble_free_datablk(inode->indirect);
+			inode->indirect = -1;
+		}
+	}
+	if(inode->dindirect != -1){
+		assemble_tag(TAG_INODE);
+		if(assemble_read((super.data_offset + inode->dindirect) * FS_BLOCK_SIZE, (char*)ptrs, FS_BLOCK_SIZE) < 0){
+			ret = -EIO;
+			goto out;
+		}
+		memcpy(old, ptrs, sizeof(ptrs));
+		for(i = 0; i < CYZFS_PTRS_PER_BLK; i++){
+			first = 6 + CYZFS_PTRS_PER_BLK + i * CYZFS_PTRS_PER_BLK;
+			if(ptrs[i] == -1 || keep >= first + CYZFS_PTRS_PER_BLK){
+				continue;
+			}
+			if(bmap_free_range(ptrs[i], keep - first) < 0){
+				ret = -EIO;
+				break;
+			}
+			if(keep <= first){
+				ptrs[i] = -1;
+			}
+		}
+		if(assemble_write((super.data_offset + inode->dindirect) * FS_BLOCK_SIZE, (char*)ptrs, FS_BLOCK_SIZE) < 0){
+			ret = -EIO;
+			goto out;
+		}
+		for(i = 0; i < CYZFS_PTRS_PER_BLK; i++){
+			if(old[i] != -1 && ptrs[i] == -1){
+				assemble_free_datablk(old[i]);
+			}
+		}
+		if(ret == 0 && keep <= 6 + CYZFS_PTRS_PER_BLK){
+			assemble_free_datablk(inode->dindirect);
+			inode->dindirect = -1;
+		}
+	}
+out:
+	assemble_tag(tag);
+	return ret;
+}
+
 int assemble_alloc_insert_dentry2inode(struct cyzfs_inode* inode, struct cyzfs_dentry* dentry){
 	/******* 对应于sfs_alloc_dentry ********/
 	/******************** 为inode分配dentry的位置并插入，若块满，需要扩充 **********************/
@@ -394,16 +799,12 @@ int assemble_alloc_insert_dentry2inode(struct cyzfs_inode* inode, struct cyzfs_d
 	if((inode->dir_cnt - 1) % dentry_per_datablock == 0){
 		/********* 需要分配一个新的块来存放dentry ***********/
 		int blkno_in_dir = (inode->dir_cnt - 1) / dentry_per_datablock;
-		int datablk_no = -1;
-		if(blkno_in_dir >= 6){
-			/***** 目录项大小超过6个数据块 ****/
+		if(assemble_bmap(inode, blkno_in_dir, TRUE) == -1){
+			/***** 目录项超过直接块与间接块能映射的范围，或没有空闲块 ****/
 			printf("Error: alloc_dentry: inode is full\n");
 			inode->dir_cnt--;
 			return -1;
 		}
-		/***** refer to assemble_alloc_inode(bitmap!) *****/
-		inode->data_pointer_mem[blkno_in_dir] = (char *) assemble_alloc_datablk(&datablk_no);
-		inode->data_pointer[blkno_in_dir] = datablk_no;
 	}
 	// int datablk_no = -1;
 	// inode->data_pointer_mem[0] = (char *) assemble_alloc_datablk(&datablk_no);
@@ -428,7 +829,60 @@ struct cyzfs_dentry * assemble_get_dentry(struct cyzfs_inode* inode, int dir){
     return NULL;
 }
 
+void assemble_free_datablk(int datablk_no){
+	/***** 在data位图中释放一个数据块 *****/
+	super.bitmap_data_ptr[datablk_no / 8] &= ~(1 << (datablk_no % 8));
+}
 
+char* assemble_get_page(struct cyzfs_inode* inode, int blk, int alloc){
+	/******* 文件第blk个数据块在内存中的页，第一次访问时才从磁盘读入 ********/
+	/******* 没有分配的块: alloc为TRUE则分配并清零，否则返回NULL，读作全0 ********/
+	int datablk_no, cnt, fresh = FALSE;
+	if(blk < 0 || blk >= CYZFS_MAX_BLKS){
+		return NULL;
+	}
+	if(blk < inode->mem_cnt && inode->data_pointer_mem[blk] != NULL){
+		return inode->data_pointer_mem[blk];
+	}
+	datablk_no = assemble_bmap(inode, blk, FALSE);
+	if(datablk_no == -1){
+		if(!alloc){
+			return NULL;
+		}
+		if((datablk_no = assemble_bmap(inode, blk, TRUE)) == -1){
+			printf("Error: get_page: no free data block\n");
+			return NULL;
+		}
+		fresh = TRUE;
+	}
+	if(blk >= inode->mem_cnt){
+		/******* 页表按需扩展，每次至少翻倍 ********/
+		cnt = inode->mem_cnt * 2 > blk + 1 ? inode->mem_cnt * 2 : blk + 1;
+		inode->data_pointer_mem = (char**)realloc(inode->data_pointer_mem, cnt * sizeof(char*));
+		inode->data_dirty = (char*)realloc(inode->data_dirty, cnt);
+		memset(inode->data_pointer_mem + inode->mem_cnt, 0, (cnt - inode->mem_cnt) * sizeof(char*));
+		memset(inode->data_dirty + inode->mem_cnt, 0, cnt - inode->mem_cnt);
+		inode->mem_cnt = cnt;
+	}
+	inode->data_pointer_mem[blk] = (char*)malloc(FS_BLOCK_SIZE);
+	if(fresh){
+		memset(inode->data_pointer_mem[blk], 0, FS_BLOCK_SIZE);
+		inode->data_dirty[blk] = TRUE;
+	}
+	else{
+		assemble_tag(TAG_DATA);
+		if(assemble_read((super.data_offset + datablk_no) * FS_BLOCK_SIZE, 
+						inode->data_pointer_mem[blk], 
+						FS_BLOCK_SIZE) < 0){
+			/******* 读失败不留下坏页，下次访问重读 ********/
+			printf("Error: get_page: read of block %d failed\n", datablk_no);
+			free(inode->data_pointer_mem[blk]);
+			inode->data_pointer_mem[blk] = NULL;
+			return NULL;
+		}
+	}
+	return inode->data_pointer_mem[blk];
+}
 
 
 /******************************************************************************
@@ -450,8 +904,11 @@ void* cyzfs_init(struct fuse_conn_info * conn_info) {
 	super.is_mounted = FALSE;
 	
 	super.fd = ddriver_open((char*)cyzfs_options.device);
+	ddriver_ioctl(super.fd, IOC_REQ_DEVICE_IO_SZ, &super.sz_io);
+	assemble_bcache_init();
 	
 	/********************** 读入超级块 ********************/
+	assemble_tag(TAG_SUPER);
 	assemble_read(0, (char*)(&super_d), sizeof(struct cyzfs_super_d));
 	if(super_d.magic != CYZFS_MAGIC){
 		//幻数不匹配，进行初始化，修改磁盘super块
@@ -483,9 +940,17 @@ void* cyzfs_init(struct fuse_conn_info * conn_info) {
 	super.data_offset = super.inode_offset + super.inode_blks;
 
 	super.bitmap_inode_ptr = (char*) malloc(super.bitmap_inode_blks * FS_BLOCK_SIZE);
-	assemble_read((super.bitmap_inode_offset * FS_BLOCK_SIZE), super.bitmap_inode_ptr, (super.bitmap_inode_blks * FS_BLOCK_SIZE));
 	super.bitmap_data_ptr = (char*) malloc(super.bitmap_data_blks * FS_BLOCK_SIZE);
-	assemble_read((super.bitmap_data_offset * FS_BLOCK_SIZE), super.bitmap_data_ptr, (super.bitmap_data_blks * FS_BLOCK_SIZE));
+	if(is_init){
+		//新盘上的位图是旧镜像留下的垃圾(比如改过幻数之前的cyzfs)，不能读
+		memset(super.bitmap_inode_ptr, 0, super.bitmap_inode_blks * FS_BLOCK_SIZE);
+		memset(super.bitmap_data_ptr, 0, super.bitmap_data_blks * FS_BLOCK_SIZE);
+	}
+	else{
+		assemble_tag(TAG_BITMAP);
+		assemble_read((super.bitmap_inode_offset * FS_BLOCK_SIZE), super.bitmap_inode_ptr, (super.bitmap_inode_blks * FS_BLOCK_SIZE));
+		assemble_read((super.bitmap_data_offset * FS_BLOCK_SIZE), super.bitmap_data_ptr, (super.bitmap_data_blks * FS_BLOCK_SIZE));
+	}
 	
 	super.root_dentry = assemble_new_dentry("/", TYPE_DIR);
 	super.root_dentry->ino = ROOT_INODE_NUM;	//根目录的inode号固定
@@ -515,33 +980,17 @@ void* cyzfs_init(struct fuse_conn_info * conn_info) {
  * @return void
  */
 void cyzfs_destroy(void* p) {
-	struct cyzfs_super_d super_d;
-
 	super.is_mounted = FALSE;
 
 /********************* 写inode和数据 ******************************/
 	assemble_sync_inode(super.root_dentry->inode);
-
-/************************写两个位图********************************/
-	assemble_write(super.bitmap_inode_offset * FS_BLOCK_SIZE, 
-					super.bitmap_inode_ptr, 
-					super.bitmap_inode_blks * FS_BLOCK_SIZE);
-	assemble_write(super.bitmap_data_offset * FS_BLOCK_SIZE, 
-					super.bitmap_data_ptr, 
-					super.bitmap_data_blks * FS_BLOCK_SIZE);
-
-/*********************** 写超级块 ********************************/
-	super_d.magic = CYZFS_MAGIC;
-	super_d.sz_usage = super.sz_usage;
-	super_d.bitmap_inode_blks = super.bitmap_inode_blks;
-	super_d.bitmap_inode_offset = super.bitmap_inode_offset;
-	super_d.bitmap_data_blks = super.bitmap_data_blks;
-	super_d.bitmap_data_offset = super.bitmap_data_offset;
-	assemble_write(0, (char *)&super_d, sizeof(struct cyzfs_super_d));
+	assemble_flush();
+	assemble_sync_meta();
 
 /****************** free in memory ************************/
 	free(super.bitmap_inode_ptr);
 	free(super.bitmap_data_ptr);
+	assemble_bcache_free();
 
 	ddriver_close(super.fd);
 
@@ -725,8 +1174,41 @@ int cyzfs_utimens(const char* path, const struct timespec tv[2]) {
  */
 int cyzfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		        struct fuse_file_info* fi) {
-	/* 选做 */
-	return size;
+	/* 只改写涉及的块在内存中的页，assemble_sync_inode时写回；空间不足时返回已写入的字节数 */
+	int	is_find, is_root;
+	int blk, lo, hi, done = 0;
+	char* page;
+	struct cyzfs_dentry* dentry = assemble_find_dentry_of_path(path, &is_find, &is_root);
+	struct cyzfs_inode* inode;
+
+	if (is_find == FALSE) {
+		return -ENOENT;
+	}
+	inode = dentry->inode;
+	if (inode->ftype == TYPE_DIR) {
+		return -EISDIR;
+	}
+	if (offset + size > (off_t)CYZFS_MAX_BLKS * FS_BLOCK_SIZE) {
+		return -EFBIG;
+	}
+
+	for (blk = offset / FS_BLOCK_SIZE; blk * FS_BLOCK_SIZE < offset + size; blk++) {
+		if ((page = assemble_get_page(inode, blk, TRUE)) == NULL) {
+			break;
+		}
+		lo = blk * FS_BLOCK_SIZE > offset ? blk * FS_BLOCK_SIZE : offset;
+		hi = (blk + 1) * FS_BLOCK_SIZE < offset + size ? (blk + 1) * FS_BLOCK_SIZE : offset + size;
+		memcpy(page + (lo - blk * FS_BLOCK_SIZE), buf + (lo - offset), hi - lo);
+		inode->data_dirty[blk] = TRUE;
+		done = hi - offset;
+	}
+	if (done == 0) {
+		return -ENOSPC;
+	}
+	if (offset + done > inode->size) {
+		inode->size = offset + done;
+	}
+	return done;
 }
 
 /**
@@ -741,7 +1223,38 @@ int cyzfs_write(const char* path, const char* buf, size_t size, off_t offset,
  */
 int cyzfs_read(const char* path, char* buf, size_t size, off_t offset,
 		       struct fuse_file_info* fi) {
-	/* 选做 */
+	/* 只装入涉及的块，没有分配的块读作全0，已分配却装不进来的块报-EIO */
+	int	is_find, is_root;
+	int blk, lo, hi;
+	char* page;
+	struct cyzfs_dentry* dentry = assemble_find_dentry_of_path(path, &is_find, &is_root);
+	struct cyzfs_inode* inode;
+
+	if (is_find == FALSE) {
+		return -ENOENT;
+	}
+	inode = dentry->inode;
+	if (inode->ftype == TYPE_DIR) {
+		return -EISDIR;
+	}
+	if (offset >= inode->size) {
+		return 0;
+	}
+	if (offset + size > inode->size) {
+		size = inode->size - offset;
+	}
+
+	for (blk = offset / FS_BLOCK_SIZE; blk * FS_BLOCK_SIZE < offset + size; blk++) {
+		page = assemble_get_page(inode, blk, FALSE);
+		if (page == NULL && assemble_bmap(inode, blk, FALSE) != -1)
+			return -EIO;
+		lo = blk * FS_BLOCK_SIZE > offset ? blk * FS_BLOCK_SIZE : offset;
+		hi = (blk + 1) * FS_BLOCK_SIZE < offset + size ? (blk + 1) * FS_BLOCK_SIZE : offset + size;
+		if (page == NULL)
+			memset(buf + (lo - offset), 0, hi - lo);
+		else
+			memcpy(buf + (lo - offset), page + (lo - blk * FS_BLOCK_SIZE), hi - lo);
+	}
 	return size;			   
 }
 
@@ -818,7 +1331,40 @@ int cyzfs_opendir(const char* path, struct fuse_file_info* fi) {
  * @return int 0成功，否则失败
  */
 int cyzfs_truncate(const char* path, off_t offset) {
-	/* 选做 */
+	/* 改大只改size，空洞读作全0；改小释放整块落在新大小之外的数据块与间接块，并清零最后一块的尾部 */
+	int	is_find, is_root;
+	int blk, keep;
+	char* page;
+	struct cyzfs_dentry* dentry = assemble_find_dentry_of_path(path, &is_find, &is_root);
+	struct cyzfs_inode* inode;
+
+	if (is_find == FALSE) {
+		return -ENOENT;
+	}
+	inode = dentry->inode;
+	if (inode->ftype == TYPE_DIR) {
+		return -EISDIR;
+	}
+	if (offset < 0 || offset > (off_t)CYZFS_MAX_BLKS * FS_BLOCK_SIZE) {
+		return -EFBIG;
+	}
+
+	keep = BLK_ROUND_UP((int)offset, FS_BLOCK_SIZE) / FS_BLOCK_SIZE;
+	for (blk = keep; blk < inode->mem_cnt; blk++) {
+		free(inode->data_pointer_mem[blk]);
+		inode->data_pointer_mem[blk] = NULL;
+		inode->data_dirty[blk] = FALSE;
+	}
+	if (assemble_bmap_truncate(inode, keep) < 0)
+		return -EIO;
+	if (offset % FS_BLOCK_SIZE != 0 && offset < inode->size) {
+		blk = offset / FS_BLOCK_SIZE;
+		if ((page = assemble_get_page(inode, blk, FALSE)) != NULL) {
+			memset(page + offset % FS_BLOCK_SIZE, 0, FS_BLOCK_SIZE - offset % FS_BLOCK_SIZE);
+			inode->data_dirty[blk] = TRUE;
+		}
+	}
+	inode->size = offset;
 	return 0;
 }
 
@@ -838,7 +1384,60 @@ int cyzfs_truncate(const char* path, off_t offset) {
 int cyzfs_access(const char* path, int type) {
 	/* 选做: 解析路径，判断是否存在 */
 	return 0;
-}	
+}
+
+/**
+ * @brief 写回文件：inode及其数据进入块缓存后，写回所有脏块，再提交位图与超级块，最后IOC_REQ_DEVICE_SYNC让驱动落盘
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 可忽略
+ * @param fi 可忽略
+ * @return int 0成功，否则失败
+ */
+int cyzfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	int	is_find, is_root;
+	struct cyzfs_dentry* dentry = assemble_find_dentry_of_path(path, &is_find, &is_root);
+	(void)datasync;
+	if (is_find == FALSE)
+		return -ENOENT;
+	if (assemble_sync_inode(dentry->inode) < 0)
+		return -EIO;
+	if (assemble_flush() < 0)
+		return -EIO;
+	if (assemble_sync_meta() < 0)
+		return -EIO;
+	if (ddriver_ioctl(super.fd, IOC_REQ_DEVICE_SYNC, NULL) < 0)		//刷回驱动缓存并fsync/msync镜像
+		return -EIO;
+	return 0;
+}
+/**
+ * @brief 只支持CYZFS_XATTR_BCACHE，挂载期间读块缓存统计"hits misses writebacks"，
+ * 如 getfattr -n user.cyzfs.bcache mnt
+ * 
+ * @param path 相对于挂载点的路径，统计是整个文件系统的
+ * @param name 属性名
+ * @param value 输出缓冲区
+ * @param size 为0时只返回所需长度
+ * @return int 属性长度，否则失败
+ */
+int cyzfs_getxattr(const char* path, const char* name, char* value, size_t size) {
+	int	is_find, is_root;
+	char buf[64];
+	int len;
+	assemble_find_dentry_of_path(path, &is_find, &is_root);
+	if (is_find == FALSE)
+		return -ENOENT;
+	if (strcmp(name, CYZFS_XATTR_BCACHE) != 0)
+		return -ENODATA;
+	len = snprintf(buf, sizeof(buf), "%lu %lu %lu",
+				   super.bcache_hits, super.bcache_misses, super.bcache_writebacks);
+	if (size == 0)
+		return len;
+	if (size < (size_t)len)
+		return -ERANGE;
+	memcpy(value, buf, len);
+	return len;
+}
 /******************************************************************************
 * SECTION: FUSE入口
 *******************************************************************************/
@@ -6,7 +6,9 @@ cd $WORK_DIR
 
 MNTPOINT='./mnt'
 PROJECT_NAME="cyzfs"
-ALL_POINTS=23
+REF_DIR=$(mktemp -d)
+trap 'rm -rf $REF_DIR' EXIT
+ALL_POINTS=33
 POINTS=0
 
 function pass() {
@@ -100,6 +102,73 @@ function test_cp() {
     echo "<<<<<<<<<<<<<<<<<<<<"
 }
 
+function cmp_tester() {
+    FILE=$1
+    echo "TEST: cmp "${MNTPOINT}/$FILE
+    cmp ${REF_DIR}/$FILE ${MNTPOINT}/$FILE
+    if [ $? -ne 0 ]; then
+        fail "cmp ${MNTPOINT}/$FILE"
+    else
+        pass "-> cmp ${MNTPOINT}/$FILE"
+    fi
+}
+
+function count_tester() {
+    DIR=$1
+    WANT=$2
+    echo "TEST: ls "$DIR" | wc -l"
+    GOT=$(ls $DIR | wc -l)
+    if [ "$GOT" -ne "$WANT" ]; then
+        fail "ls $DIR: $GOT entries, want $WANT"
+    else
+        pass "-> ls $DIR: $WANT entries"
+    fi
+}
+
+function test_data() {
+    TEST_CASE=$1
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_DATA"
+
+    # 写后读
+    echo "hello cyzfs" > ${REF_DIR}/small
+    echo "hello cyzfs" > ${MNTPOINT}/small
+    cmp_tester small
+
+    # 64KiB，超过6个直接块，用到一次间接块
+    head -c 65536 /dev/urandom > ${REF_DIR}/big
+    cp ${REF_DIR}/big ${MNTPOINT}/big
+    cmp_tester big
+
+    # 写在第400块，用到二次间接块，前面的空洞读作全0
+    head -c 4096 /dev/urandom > ${REF_DIR}/chunk
+    dd if=${REF_DIR}/chunk of=${REF_DIR}/dind bs=1024 seek=400 status=none
+    dd if=${REF_DIR}/chunk of=${MNTPOINT}/dind bs=1024 seek=400 status=none
+    cmp_tester dind
+
+    # 截短后再扩大，截掉的部分读作全0
+    cp ${REF_DIR}/big ${REF_DIR}/trunc
+    cp ${REF_DIR}/big ${MNTPOINT}/trunc
+    truncate -s 3000 ${REF_DIR}/trunc ${MNTPOINT}/trunc
+    truncate -s 8192 ${REF_DIR}/trunc ${MNTPOINT}/trunc
+    cmp_tester trunc
+
+    echo "<<<<<<<<<<<<<<<<<<<<"
+}
+
+function test_many() {
+    TEST_CASE=$1
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_MANY"
+
+    # 一个数据块放7个目录项，6个直接块最多42个，50个要用到一次间接块
+    mkdir ${MNTPOINT}/many
+    for i in $(seq 0 49); do
+        touch ${MNTPOINT}/many/file$i
+    done
+    count_tester ${MNTPOINT}/many 50
+
+    echo "<<<<<<<<<<<<<<<<<<<<"
+}
+
 function test_remount() {
     TEST_CASE=$1
     echo ">>>>>>>>>>>>>>>>>>>> TEST_REMOUNT"
@@ -124,6 +193,12 @@ function test_remount() {
     core_tester ls ${MNTPOINT}/dir0/dir0/dir0;
     core_tester ls ${MNTPOINT}/dir1;
 
+    cmp_tester small
+    cmp_tester big
+    cmp_tester dind
+    cmp_tester trunc
+    count_tester ${MNTPOINT}/many 50
+
     sleep 1
     
     fusermount -u ${MNTPOINT}
@@ -147,6 +222,10 @@ function test_main() {
     echo ""
     test_ls "[all-the-ls-test]"
     echo ""
+    test_data "[all-the-data-test]"
+    echo ""
+    test_many "[all-the-many-test]"
+    echo ""
     test_remount "[all-the-remount-test]"
     echo ""
 
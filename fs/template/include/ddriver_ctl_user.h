@@ -11,11 +11,105 @@ struct ddriver_state
     int write_cnt;
     int read_cnt;
     int seek_cnt;
+    int queue_depth;                            /* 异步队列深度 */
+    int inflight;                               /* 已提交未收割的异步请求数 */
+};
+
+#define DDRIVER_FLUSH_BARRIER   0x1             /* IOC_REQ_DEVICE_FLUSH参数: 只插入屏障，不立即刷回 */
+
+struct ddriver_discard                          /* IOC_REQ_DEVICE_DISCARD参数，需与IO单位对齐 */
+{
+    long long offset;
+    long long len;
+};
+
+#define DDRIVER_ATOMIC_MAX      32              /* IOC_REQ_DEVICE_ATOMIC_WRITE一次最多的IO单位数 */
+
+struct ddriver_atomic_vec                       /* 一个IO单位 */
+{
+    long long offset;                           /* 与IO单位对齐的设备偏移 */
+    char *buf;                                  /* 一个IO单位大小的数据 */
+};
+
+struct ddriver_atomic_write                     /* IOC_REQ_DEVICE_ATOMIC_WRITE参数，全部写入或全部不写 */
+{
+    int count;                                  /* vecs个数，不超过DDRIVER_ATOMIC_MAX */
+    struct ddriver_atomic_vec *vecs;
+};
+
+#define DDRIVER_STATE_VERSION   6               /* ddriver_state_ext当前版本 */
+#define DDRIVER_HIST_BUCKETS    32
+#define DDRIVER_LAT_READ        0               /* lat_hist下标: 读 */
+#define DDRIVER_LAT_WRITE       1               /* lat_hist下标: 写 */
+#define DDRIVER_LAT_SEEK        2               /* lat_hist下标: 寻道 */
+#define DDRIVER_LAT_OPS         3
+#define DDRIVER_TAGS            16              /* IOC_REQ_DEVICE_TAG的标签取值[0, DDRIVER_TAGS)，0为未标记 */
+
+struct ddriver_tag_stat                         /* 某个标签下的请求统计 */
+{
+    unsigned long long read_reqs;               /* 读请求数 */
+    unsigned long long write_reqs;              /* 写请求数 */
+    unsigned long long read_bytes;
+    unsigned long long write_bytes;
+    unsigned long long read_lat_ns;             /* 读请求延迟之和，ns */
+    unsigned long long write_lat_ns;            /* 写请求延迟之和，ns */
+};
+
+struct ddriver_heat                             /* 某个IO单位的访问热度 */
+{
+    unsigned int read_cnt;                      /* 读过的次数 */
+    unsigned int write_cnt;                     /* 写过的次数 */
+    unsigned int last_epoch;                    /* 最后一次访问时的设备请求序号，0为从未访问 */
+};
+
+struct ddriver_heatmap                          /* IOC_REQ_DEVICE_HEATMAP参数 */
+{
+    long long lba;                              /* 入: 起始IO单位号 */
+    int count;                                  /* 入: ents容量，出: 实际填充个数 */
+    unsigned int epoch;                         /* 出: 当前设备请求序号 */
+    struct ddriver_heat *ents;                  /* 入: 调用者分配的数组 */
+};
+
+/**
+ * @brief IOC_REQ_DEVICE_STATE_EXT参数。调用前填写version与size(sizeof)，
+ * 驱动按size截断填充，因此新增字段只追加在末尾
+ */
+struct ddriver_state_ext
+{
+    int version;                                /* 入: 调用者版本，出: 驱动版本 */
+    int size;                                   /* 入: 调用者结构大小，出: 实际填充大小 */
+    unsigned long long read_cnt;                /* 读IO单位数 */
+    unsigned long long write_cnt;               /* 写IO单位数 */
+    unsigned long long seek_cnt;                /* 寻道次数 */
+    unsigned long long read_bytes;
+    unsigned long long write_bytes;
+    unsigned long long lat_hist[DDRIVER_LAT_OPS][DDRIVER_HIST_BUCKETS];   /* [i]: 延迟在[2^i, 2^(i+1))ns */
+    unsigned long long seek_hist[DDRIVER_HIST_BUCKETS];                   /* [0]: 顺序，[i]: 距离在[2^(i-1), 2^i)个IO单位 */
+    unsigned long long cache_read_hits;         /* v2: 从写回缓存读出的IO单位数 */
+    unsigned long long cache_write_hits;        /* v2: 覆盖缓存中脏单位、未落盘的写 */
+    unsigned long long cache_flush_runs;        /* v2: 刷回时合并出的连续写次数 */
+    unsigned long long model_ns;                /* v3: 设备模型累计的设备时间，ns */
+    unsigned long long model_throttle_ns;       /* v3: 其中被带宽上限拖慢的部分 */
+    struct ddriver_tag_stat tags[DDRIVER_TAGS]; /* v4: 按请求标签统计 */
+    unsigned long long sched_batches;           /* v5: ddriver_submit_batch批数 */
+    unsigned long long sched_merges;            /* v5: 批内并入相邻请求的请求数 */
+    unsigned long long sched_seeks_saved;       /* v5: 按LBA调度比按提交顺序少的寻道数 */
+    unsigned long long write_elided;            /* v6: 内容未变而跳过的写，IO单位数 */
 };
 
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)                     /* 请求查看设备大小 */
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)    /* 请求设备状态，返回 ddriver_state */
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)                           /* 请求重置设备 */
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)                     /* 请求设备IO大小 */
+#define IOC_REQ_DEVICE_SYNC     _IO(IOC_MAGIC, 4)                           /* 请求将写入刷回磁盘镜像 */
+#define IOC_REQ_DEVICE_SIZE64   _IOR(IOC_MAGIC, 5, long long)               /* 请求查看设备大小，64位，支持超过2GiB的设备 */
+#define IOC_REQ_DEVICE_DISCARD  _IOW(IOC_MAGIC, 6, struct ddriver_discard)  /* 请求丢弃一段数据 (TRIM)，之后读出全0 */
+#define IOC_REQ_DEVICE_STATE_EXT _IOWR(IOC_MAGIC, 7, struct ddriver_state_ext) /* 请求扩展设备状态，参数为 ddriver_state_ext */
+#define IOC_REQ_DEVICE_FLUSH    _IOW(IOC_MAGIC, 8, int)                     /* 请求刷回写回缓存，参数为标志位，可为NULL */
+#define IOC_REQ_DEVICE_SNAPSHOT _IO(IOC_MAGIC, 9)                           /* 请求为镜像打快照，覆盖上一个快照 */
+#define IOC_REQ_DEVICE_ROLLBACK _IO(IOC_MAGIC, 10)                          /* 请求将镜像回滚到快照，快照保留可反复回滚 */
+#define IOC_REQ_DEVICE_TAG      _IOW(IOC_MAGIC, 11, int)                    /* 设置调用线程之后请求的标签，参数为int标签 */
+#define IOC_REQ_DEVICE_HEATMAP _IOWR(IOC_MAGIC, 12, struct ddriver_heatmap) /* 请求一段IO单位的访问热度，参数为 ddriver_heatmap */
+#define IOC_REQ_DEVICE_ATOMIC_WRITE _IOW(IOC_MAGIC, 13, struct ddriver_atomic_write) /* 请求原子地写入多个IO单位，崩溃后打开设备时重做，参数为 ddriver_atomic_write */
 
 #endif
\ No newline at end of file
@@ -4,11 +4,68 @@
 #include "ddriver_ctl_user.h"
 #include "stdio.h"
 
+#define DDRIVER_OPT_MMAP        0x1
+#define DDRIVER_OPT_SLEEP       0x2
+#define DDRIVER_OPT_HEATMAP     0x4
+#define DDRIVER_OPT_SPARSE      0x8
+#define DDRIVER_OPT_ELIDE       0x10
+
+#define DDRIVER_MODEL_NONE      0
+#define DDRIVER_MODEL_HDD       1
+#define DDRIVER_MODEL_SSD       2
+#define DDRIVER_MODEL_NVME      3
+
+#define DDRIVER_LOG_DEFAULT     0
+#define DDRIVER_LOG_NONE        1
+#define DDRIVER_LOG_ALERT       2
+#define DDRIVER_LOG_INFO        3
+
+struct ddriver_options
+{
+    int flags;
+    long long disk_size;
+    int iounit_size;
+    int queue_depth;
+    long long cache_size;
+    int model;
+    long long bw_limit;
+    const char *trace_path;
+    long long trace_size;
+    int log_level;
+};
+
+#define DDRIVER_OP_READ         0
+#define DDRIVER_OP_WRITE        1
+
+struct ddriver_req
+{
+    int    op;
+    char  *buf;
+    size_t size;
+    off_t  offset;
+    void  *user_data;
+};
+
+struct ddriver_cpl
+{
+    void  *user_data;
+    int    res;
+};
+
 int ddriver_open(char *path);
+int ddriver_open_opts(char *path, struct ddriver_options *opts);
 int ddriver_seek(int fd, off_t offset, int whence);
 int ddriver_write(int fd, char *buf, size_t size);
 int ddriver_read(int fd, char *buf, size_t size);
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+int ddriver_read_blocks(int fd, off_t lba, int blks, char *buf);
+int ddriver_write_blocks(int fd, off_t lba, int blks, char *buf);
 int ddriver_ioctl(int fd, unsigned long cmd, void *ret);
+const char *ddriver_block_ptr(int fd, off_t offset);
+int ddriver_submit(int fd, struct ddriver_req *reqs, int n);
+int ddriver_reap(int fd, struct ddriver_cpl *cpls, int max, int timeout_ms);
+int ddriver_submit_batch(int fd, struct ddriver_req *reqs, int n);
 int ddriver_close(int fd);
 
 #endif /* _DDRIVER_H_ */
\ No newline at end of file
@@ -12,10 +12,100 @@ struct ddriver_state
     int write_cnt;
     int read_cnt;
     int seek_cnt;
+    int queue_depth;
+    int inflight;
+};
+
+#define DDRIVER_FLUSH_BARRIER   0x1
+
+struct ddriver_discard
+{
+    long long offset;
+    long long len;
+};
+
+#define DDRIVER_ATOMIC_MAX      32
+
+struct ddriver_atomic_vec
+{
+    long long offset;
+    char *buf;
+};
+
+struct ddriver_atomic_write
+{
+    int count;
+    struct ddriver_atomic_vec *vecs;
+};
+
+#define DDRIVER_STATE_VERSION   6
+#define DDRIVER_HIST_BUCKETS    32
+#define DDRIVER_LAT_READ        0
+#define DDRIVER_LAT_WRITE       1
+#define DDRIVER_LAT_SEEK        2
+#define DDRIVER_LAT_OPS         3
+#define DDRIVER_TAGS            16
+
+struct ddriver_tag_stat
+{
+    unsigned long long read_reqs;
+    unsigned long long write_reqs;
+    unsigned long long read_bytes;
+    unsigned long long write_bytes;
+    unsigned long long read_lat_ns;
+    unsigned long long write_lat_ns;
+};
+
+struct ddriver_heat
+{
+    unsigned int read_cnt;
+    unsigned int write_cnt;
+    unsigned int last_epoch;
+};
+
+struct ddriver_heatmap
+{
+    long long lba;
+    int count;
+    unsigned int epoch;
+    struct ddriver_heat *ents;
+};
+
+struct ddriver_state_ext
+{
+    int version;
+    int size;
+    unsigned long long read_cnt;
+    unsigned long long write_cnt;
+    unsigned long long seek_cnt;
+    unsigned long long read_bytes;
+    unsigned long long write_bytes;
+    unsigned long long lat_hist[DDRIVER_LAT_OPS][DDRIVER_HIST_BUCKETS];
+    unsigned long long seek_hist[DDRIVER_HIST_BUCKETS];
+    unsigned long long cache_read_hits;
+    unsigned long long cache_write_hits;
+    unsigned long long cache_flush_runs;
+    unsigned long long model_ns;
+    unsigned long long model_throttle_ns;
+    struct ddriver_tag_stat tags[DDRIVER_TAGS];
+    unsigned long long sched_batches;
+    unsigned long long sched_merges;
+    unsigned long long sched_seeks_saved;
+    unsigned long long write_elided;
 };
 
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)
+#define IOC_REQ_DEVICE_SYNC     _IO(IOC_MAGIC, 4)
+#define IOC_REQ_DEVICE_SIZE64   _IOR(IOC_MAGIC, 5, long long)
+#define IOC_REQ_DEVICE_DISCARD  _IOW(IOC_MAGIC, 6, struct ddriver_discard)
+#define IOC_REQ_DEVICE_STATE_EXT _IOWR(IOC_MAGIC, 7, struct ddriver_state_ext)
+#define IOC_REQ_DEVICE_FLUSH    _IOW(IOC_MAGIC, 8, int)
+#define IOC_REQ_DEVICE_SNAPSHOT _IO(IOC_MAGIC, 9)
+#define IOC_REQ_DEVICE_ROLLBACK _IO(IOC_MAGIC, 10)
+#define IOC_REQ_DEVICE_TAG      _IOW(IOC_MAGIC, 11, int)
+#define IOC_REQ_DEVICE_HEATMAP _IOWR(IOC_MAGIC, 12, struct ddriver_heatmap)
+#define IOC_REQ_DEVICE_ATOMIC_WRITE _IOW(IOC_MAGIC, 13, struct ddriver_atomic_write)
 #endif
\ No newline at end of file
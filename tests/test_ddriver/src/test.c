@@ -1,5 +1,30 @@
 #include "../include/ddriver.h"
 #include <linux/fs.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define MT_THREADS  4
+#define MT_BLKS     16
+#define MT_BASE     8
+
+static int mt_fd;
+
+static void *mt_worker(void *arg)
+{
+    long id = (long)arg;
+    char wbuf[512], rbuf[512];
+    int i;
+    for (i = 0; i < MT_BLKS; i++) {
+        memset(wbuf, 'A' + id, sizeof(wbuf));
+        wbuf[0] = (char)i;
+        ddriver_pwrite(mt_fd, wbuf, 512, (MT_BASE + id * MT_BLKS + i) * 512);
+        ddriver_pread(mt_fd, rbuf, 512, (MT_BASE + id * MT_BLKS + i) * 512);
+        if (memcmp(wbuf, rbuf, 512) != 0)
+            return (void *)1;
+    }
+    return NULL;
+}
 
 int main(int argc, char const *argv[])
 {
@@ -20,6 +45,296 @@ int main(int argc, char const *argv[])
     ddriver_seek(fd, 0, SEEK_SET);
     ddriver_read(fd, rbuffer, 512);
     printf("%s\n", rbuffer);
+    ddriver_seek(fd, 0, SEEK_END);
+    if (ddriver_write(fd, buffer, 512) != -EINVAL || ddriver_read(fd, rbuffer, 512) != -EINVAL) {
+        printf("io past the device end accepted\n");
+        return -1;
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SIZE, &size);
+    if (ddriver_seek(fd, 0, SEEK_CUR) != size) {
+        printf("rejected io moved the cursor\n");
+        return -1;
+    }
+
+    /* Cycle 1.1: multi-block read/write test */
+    char mbuffer[4 * 512];
+    char mrbuffer[4 * 512];
+    memset(mbuffer, 'b', sizeof(mbuffer));
+    ddriver_write_blocks(fd, 1, 4, mbuffer);
+    ddriver_read_blocks(fd, 1, 4, mrbuffer);
+    if (memcmp(mbuffer, mrbuffer, sizeof(mbuffer)) != 0) {
+        printf("multi-block mismatch\n");
+        return -1;
+    }
+
+    /* Cycle 1.2: concurrent positioned read/write test */
+    pthread_t workers[MT_THREADS];
+    struct ddriver_state before, after;
+    void *ret;
+    long t;
+    int fail = 0;
+    mt_fd = fd;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE, &before);
+    for (t = 0; t < MT_THREADS; t++)
+        pthread_create(&workers[t], NULL, mt_worker, (void *)t);
+    for (t = 0; t < MT_THREADS; t++) {
+        pthread_join(workers[t], &ret);
+        fail |= ret != NULL;
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE, &after);
+    if (fail || after.write_cnt - before.write_cnt != MT_THREADS * MT_BLKS ||
+        after.read_cnt - before.read_cnt != MT_THREADS * MT_BLKS) {
+        printf("concurrent io mismatch\n");
+        return -1;
+    }
+
+    /* Cycle 1.3: second device instance test */
+    struct ddriver_options opts = { .iounit_size = 4096 };
+    struct ddriver_state other;
+    char big[4096];
+    int fd2 = ddriver_open_opts("/home/cyz/ddriver_meta", &opts);
+    if (fd2 < 0 || fd2 == fd) {
+        printf("second device open failed\n");
+        return -1;
+    }
+    memset(big, 'c', sizeof(big));
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE, &before);
+    ddriver_pwrite(fd2, big, sizeof(big), 0);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE, &after);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_IO_SZ, &size);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_STATE, &other);
+    if (size != 4096 || other.write_cnt != 1 || after.write_cnt != before.write_cnt) {
+        printf("device instances not independent\n");
+        return -1;
+    }
+    ddriver_close(fd2);
+
+    /* Cycle 1.4: request tag test */
+    struct ddriver_state_ext ext;
+    int tag = 3;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_TAG, &tag);
+    ddriver_pwrite(fd, mbuffer, 2 * 512, 0);
+    tag = 0;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_TAG, &tag);
+    ddriver_pread(fd, mrbuffer, 512, 0);
+    ext.version = DDRIVER_STATE_VERSION;
+    ext.size = sizeof(ext);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE_EXT, &ext);
+    if (ext.tags[3].write_reqs != 1 || ext.tags[3].write_bytes != 2 * 512 ||
+        ext.tags[3].read_reqs != 0) {
+        printf("request tag mismatch\n");
+        return -1;
+    }
+
+    /* Cycle 1.5: heatmap test */
+    struct ddriver_heat heat[2];
+    struct ddriver_heatmap hm = { .lba = 0, .count = 2, .ents = heat };
+    opts.flags = DDRIVER_OPT_HEATMAP;
+    fd2 = ddriver_open_opts("/home/cyz/ddriver_meta", &opts);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_RESET, NULL);
+    ddriver_pwrite(fd2, big, sizeof(big), 4096);
+    ddriver_pwrite(fd2, big, sizeof(big), 4096);
+    ddriver_pread(fd2, big, sizeof(big), 4096);
+    if (ddriver_ioctl(fd2, IOC_REQ_DEVICE_HEATMAP, &hm) < 0 || hm.count != 2 || hm.epoch != 3 ||
+        heat[0].write_cnt != 0 || heat[1].write_cnt != 2 || heat[1].read_cnt != 1 ||
+        heat[1].last_epoch != 3) {
+        printf("heatmap mismatch\n");
+        return -1;
+    }
+    ddriver_close(fd2);
+
+    /* Cycle 1.6: sparse image test */
+    char zero[4096], sbuf[4096];
+    long long sz64;
+    opts.flags = DDRIVER_OPT_SPARSE;
+    opts.disk_size = 1LL << 30;
+    fd2 = ddriver_open_opts("/home/cyz/ddriver_sparse", &opts);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_RESET, NULL);
+    memset(zero, 0, sizeof(zero));
+    memset(big, 's', sizeof(big));
+    ddriver_pwrite(fd2, big, sizeof(big), (1LL << 30) - 4096);
+    ddriver_close(fd2);
+    opts.flags = 0;
+    opts.disk_size = 0;
+    fd2 = ddriver_open_opts("/home/cyz/ddriver_sparse", &opts);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_SIZE64, &sz64);
+    ddriver_pread(fd2, sbuf, sizeof(sbuf), 1LL << 29);
+    if (sz64 != 1LL << 30 || memcmp(sbuf, zero, sizeof(zero)) != 0) {
+        printf("sparse image not zero filled\n");
+        return -1;
+    }
+    ddriver_pread(fd2, sbuf, sizeof(sbuf), (1LL << 30) - 4096);
+    if (memcmp(sbuf, big, sizeof(big)) != 0) {
+        printf("sparse image mismatch\n");
+        return -1;
+    }
+    ddriver_close(fd2);
+
+    /* Cycle 1.7: write elision test */
+    opts.flags = DDRIVER_OPT_ELIDE;
+    fd2 = ddriver_open_opts("/home/cyz/ddriver_meta", &opts);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_RESET, NULL);
+    memset(big, 'e', sizeof(big));
+    ddriver_pwrite(fd2, big, sizeof(big), 0);
+    ddriver_pwrite(fd2, big, sizeof(big), 0);
+    ddriver_pwrite(fd2, zero, sizeof(zero), 4096);
+    ddriver_pread(fd2, sbuf, sizeof(sbuf), 0);
+    ext.version = DDRIVER_STATE_VERSION;
+    ext.size = sizeof(ext);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_STATE_EXT, &ext);
+    if (ext.write_elided != 2 || ext.write_cnt != 1 || memcmp(sbuf, big, sizeof(big)) != 0) {
+        printf("write elision mismatch\n");
+        return -1;
+    }
+    char tri[3 * 4096];
+    memset(tri, 'a', sizeof(tri));
+    ddriver_pwrite(fd2, tri, sizeof(tri), 0);
+    memset(tri, 'b', 4096);
+    memset(tri + 2 * 4096, 'c', 4096);
+    ddriver_pwrite(fd2, tri, sizeof(tri), 0);
+    ddriver_pread(fd2, tri, sizeof(tri), 0);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_STATE_EXT, &ext);
+    if (ext.write_elided != 3 || ext.write_cnt != 6 || tri[0] != 'b' || tri[4096] != 'a' ||
+        tri[2 * 4096] != 'c') {
+        printf("write elision run mismatch\n");
+        return -1;
+    }
+    ddriver_close(fd2);
+
+    /* Cycle 1.8: write-back cache test */
+    struct ddriver_discard dis = { 4096, 4096 };
+    int flush = DDRIVER_FLUSH_BARRIER;
+    opts.flags = 0;
+    opts.cache_size = 16 * 4096;
+    fd2 = ddriver_open_opts("/home/cyz/ddriver_meta", &opts);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_RESET, NULL);
+    memset(big, 'w', sizeof(big));
+    ddriver_pwrite(fd2, big, sizeof(big), 0);
+    ddriver_pwrite(fd2, big, sizeof(big), 4096);
+    ddriver_pread(fd2, sbuf, sizeof(sbuf), 0);
+    ext.version = DDRIVER_STATE_VERSION;
+    ext.size = sizeof(ext);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_STATE_EXT, &ext);
+    if (ext.write_cnt != 0 || ext.read_cnt != 0 || ext.cache_read_hits != 1 ||
+        memcmp(sbuf, big, sizeof(big)) != 0) {
+        printf("cache read mismatch\n");
+        return -1;
+    }
+    if (ddriver_ioctl(fd2, IOC_REQ_DEVICE_DISCARD, NULL) != -EINVAL) {
+        printf("discard without a range accepted\n");
+        return -1;
+    }
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_DISCARD, &dis);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_FLUSH, NULL);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_STATE_EXT, &ext);
+    if (ext.write_cnt != 1 || ext.cache_flush_runs != 1) {
+        printf("cache flush mismatch\n");
+        return -1;
+    }
+    ddriver_pwrite(fd2, big, sizeof(big), 2 * 4096);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_FLUSH, &flush);
+    ddriver_pwrite(fd2, big, sizeof(big), 2 * 4096);
+    ddriver_pwrite(fd2, big, sizeof(big), 2 * 4096);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_STATE_EXT, &ext);
+    if (ext.cache_flush_runs != 2 || ext.cache_write_hits != 1) {
+        printf("cache barrier mismatch\n");
+        return -1;
+    }
+    ddriver_close(fd2);
+    opts.cache_size = 0;
+    fd2 = ddriver_open_opts("/home/cyz/ddriver_meta", &opts);
+    ddriver_pread(fd2, sbuf, sizeof(sbuf), 0);
+    if (memcmp(sbuf, big, sizeof(big)) != 0) {
+        printf("cached write lost on reopen\n");
+        return -1;
+    }
+    ddriver_pread(fd2, sbuf, sizeof(sbuf), 4096);
+    if (memcmp(sbuf, zero, sizeof(zero)) != 0) {
+        printf("discarded range not zero\n");
+        return -1;
+    }
+    ddriver_close(fd2);
+    opts.cache_size = 16 * 4096;
+    fd2 = ddriver_open_opts("/home/cyz/ddriver_meta", &opts);
+    ddriver_pwrite(fd2, big, sizeof(big), 4096);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_RESET, NULL);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_FLUSH, NULL);
+    ddriver_pread(fd2, sbuf, sizeof(sbuf), 4096);
+    if (memcmp(sbuf, zero, sizeof(zero)) != 0) {
+        printf("reset kept cached data\n");
+        return -1;
+    }
+    ddriver_close(fd2);
+    opts.cache_size = 0;
+
+    /* Cycle 1.9: async submit/reap test */
+    struct ddriver_req areqs[2] = {
+        { DDRIVER_OP_WRITE, big, sizeof(big), 3 * 4096, (void *)1 },
+        { DDRIVER_OP_WRITE, zero, sizeof(zero), 5 * 4096, (void *)2 }
+    };
+    struct ddriver_cpl cpls[2];
+    int done = 0, got;
+    memset(big, 'q', sizeof(big));
+    opts.queue_depth = 4;
+    fd2 = ddriver_open_opts("/home/cyz/ddriver_meta", &opts);
+    if (ddriver_submit(fd2, areqs, 2) != 2) {
+        printf("async submit failed\n");
+        return -1;
+    }
+    while (done < 2 && (got = ddriver_reap(fd2, cpls + done, 2 - done, -1)) > 0)
+        done += got;
+    if (done != 2 || cpls[0].res != 4096 || cpls[1].res != 4096 ||
+        (long)cpls[0].user_data + (long)cpls[1].user_data != 3) {
+        printf("async completion mismatch\n");
+        return -1;
+    }
+    areqs[0].op = DDRIVER_OP_READ;
+    areqs[0].buf = sbuf;
+    if (ddriver_submit(fd2, areqs, 1) != 1 || ddriver_reap(fd2, cpls, 1, -1) != 1 ||
+        cpls[0].res != 4096 || memcmp(sbuf, big, sizeof(big)) != 0) {
+        printf("async read mismatch\n");
+        return -1;
+    }
+    ddriver_close(fd2);
+    opts.queue_depth = 0;
+
+    /* Cycle 1.10: mmap test */
+    const char *blk;
+    opts.flags = DDRIVER_OPT_MMAP;
+    fd2 = ddriver_open_opts("/home/cyz/ddriver_meta", &opts);
+    memset(big, 'm', sizeof(big));
+    ddriver_pwrite(fd2, big, sizeof(big), 6 * 4096);
+    blk = ddriver_block_ptr(fd2, 6 * 4096);
+    if (blk == NULL || memcmp(blk, big, sizeof(big)) != 0 ||
+        ddriver_pwrite(fd2, big, sizeof(big), 1LL << 40) != -EINVAL) {
+        printf("mmap mismatch\n");
+        return -1;
+    }
+    ddriver_close(fd2);
+    opts.flags = 0;
+
+    /* Cycle 1.11: timing model test */
+    unsigned long long seq_ns, far_ns;
+    opts.model = DDRIVER_MODEL_HDD;
+    fd2 = ddriver_open_opts("/home/cyz/ddriver_meta", &opts);
+    ddriver_pwrite(fd2, big, sizeof(big), 0);
+    ext.version = DDRIVER_STATE_VERSION;
+    ext.size = sizeof(ext);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_STATE_EXT, &ext);
+    seq_ns = ext.model_ns;
+    ddriver_pwrite(fd2, big, sizeof(big), 4096);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_STATE_EXT, &ext);
+    far_ns = ext.model_ns;
+    seq_ns = far_ns - seq_ns;
+    ddriver_pwrite(fd2, big, sizeof(big), (1LL << 22) - 4096);
+    ddriver_ioctl(fd2, IOC_REQ_DEVICE_STATE_EXT, &ext);
+    far_ns = ext.model_ns - far_ns;
+    if (seq_ns == 0 || far_ns <= seq_ns) {
+        printf("timing model mismatch\n");
+        return -1;
+    }
+    ddriver_close(fd2);
+    opts.model = DDRIVER_MODEL_NONE;
 
     /* Cycle 2: ioctl test - return int */
     ddriver_ioctl(fd, IOC_REQ_DEVICE_SIZE, &size);
@@ -42,6 +357,76 @@ int main(int argc, char const *argv[])
     printf("write_cnt: %d\n", state.write_cnt);
     printf("seek_cnt: %d\n", state.seek_cnt);
 
+    /* Cycle 5: snapshot/rollback test */
+    ddriver_pwrite(fd, mbuffer, 512, 0);
+    if (ddriver_ioctl(fd, IOC_REQ_DEVICE_SNAPSHOT, NULL) < 0) {
+        printf("snapshot failed\n");
+        return -1;
+    }
+    memset(buffer, 'z', sizeof(buffer));
+    ddriver_pwrite(fd, buffer, 512, 0);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_ROLLBACK, NULL);
+    ddriver_pread(fd, rbuffer, 512, 0);
+    if (memcmp(rbuffer, mbuffer, 512) != 0) {
+        printf("rollback mismatch\n");
+        return -1;
+    }
+
+    /* Cycle 6: atomic multi-block write test */
+    struct ddriver_atomic_vec vecs[3] = {
+        { 0, mbuffer }, { 7 * 512, mbuffer + 512 }, { 14 * 512, mbuffer + 1024 }
+    };
+    struct ddriver_atomic_write aw = { 3, vecs };
+    memset(mbuffer, 'x', 512);
+    memset(mbuffer + 512, 'y', 512);
+    memset(mbuffer + 1024, 'z', 512);
+    if (ddriver_ioctl(fd, IOC_REQ_DEVICE_ATOMIC_WRITE, &aw) != 3) {
+        printf("atomic write failed\n");
+        return -1;
+    }
+    for (t = 0; t < 3; t++) {
+        ddriver_pread(fd, rbuffer, 512, vecs[t].offset);
+        if (memcmp(rbuffer, vecs[t].buf, 512) != 0) {
+            printf("atomic write mismatch\n");
+            return -1;
+        }
+    }
+    opts.iounit_size = 0;
+    opts.disk_size = 2LL * size;
+    if ((fd2 = ddriver_open_opts("/home/cyz/ddriver", &opts)) >= 0) {
+        printf("raw image of another size opened\n");
+        return -1;
+    }
+    opts.disk_size = 0;
+
+    /* Cycle 7: LBA-sorted batch test */
+    struct ddriver_req breqs[4] = {
+        { DDRIVER_OP_WRITE, mbuffer + 512, 512, 21 * 512, NULL },
+        { DDRIVER_OP_WRITE, mbuffer, 512, 20 * 512, NULL },
+        { DDRIVER_OP_WRITE, mbuffer + 1024, 512, 2 * 512, NULL },
+        { DDRIVER_OP_WRITE, mbuffer, 512, 22 * 512, NULL }
+    };
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_RESET, NULL);
+    ddriver_seek(fd, 10 * 512, SEEK_SET);
+    if (ddriver_submit_batch(fd, breqs, 4) != 4) {
+        printf("batch submit failed\n");
+        return -1;
+    }
+    for (t = 0; t < 4; t++) {
+        ddriver_pread(fd, rbuffer, 512, breqs[t].offset);
+        if (memcmp(rbuffer, breqs[t].buf, 512) != 0) {
+            printf("batch mismatch\n");
+            return -1;
+        }
+    }
+    ext.version = DDRIVER_STATE_VERSION;
+    ext.size = sizeof(ext);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE_EXT, &ext);
+    if (ext.sched_batches != 1 || ext.sched_merges != 2 || ext.sched_seeks_saved != 2) {
+        printf("batch schedule mismatch\n");
+        return -1;
+    }
+
     ddriver_close(fd);
 
     printf("Test Pass :)\n");